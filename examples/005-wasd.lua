@@ -1,7 +1,7 @@
 -- ShaderChunks
 -- include pastebin://Rqpqfa7i
 -- WASDControls
--- include pastebin://8pSbGmFq
+-- include https://raw.githubusercontent.com/danielesteban/navigator/main/examples/includes/wasdcontrols.lua
 
 shader = Shader(
 VertexWithNormalAndPosition,
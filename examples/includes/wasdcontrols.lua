@@ -12,7 +12,8 @@ function WASDControls:new(o)
   self.__index = self
   o.dphi = o.phi
   o.dtheta = o.theta
-  o.target = { x = o.position.x, y = o.position.y, z = o.position.z }
+  o.character = Character(0.5, 1)
+  o.character:setPosition(o.position.x, o.position.y, o.position.z)
   return o
 end
 
@@ -65,19 +66,20 @@ function WASDControls:update()
     movement.z = z
   end
 
-  local step = 10.0 * (keyboard("shift") and 2 or 1) * delta
-  self.target.x = self.target.x + self.front.x * movement.z * step + self.right.x * movement.x * step
-  self.target.y = self.target.y + -10 * delta
-  self.target.z = self.target.z + self.front.z * movement.z * step + self.right.z * movement.x * step
-
-  x, y, z = physics.getContacts("capsule", self.target.x, self.target.y, self.target.z, 1, 2.0, 1)
-  self.target.x = self.target.x + x
-  self.target.y = self.target.y + y
-  self.target.z = self.target.z + z
+  local speed = 10.0 * (keyboard("shift") and 2 or 1)
+  self.character:setVelocity(
+    (self.front.x * movement.z + self.right.x * movement.x) * speed,
+    0,
+    (self.front.z * movement.z + self.right.z * movement.x) * speed
+  )
+  if keyboard(" ") and self.character:isOnGround() then
+    self.character:jump()
+  end
 
-  self.position.x = math.lerp(self.position.x, self.target.x, damp)
-  self.position.y = math.lerp(self.position.y, self.target.y, damp)
-  self.position.z = math.lerp(self.position.z, self.target.z, damp)
+  x, y, z = self.character:getPosition()
+  self.position.x = math.lerp(self.position.x, x, damp)
+  self.position.y = math.lerp(self.position.y, y, damp)
+  self.position.z = math.lerp(self.position.z, z, damp)
   camera.setPosition(self.position.x, self.position.y + 1, self.position.z)
   camera.lookAt(self.position.x + self.front.x, self.position.y + 1 + self.front.y, self.position.z + self.front.z)
 end
@@ -0,0 +1,67 @@
+#include "benchmark.hpp"
+#include "physics.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+void PhysicsBenchmark::run() {
+  const GLint maxThreads = glm::max((GLint) std::thread::hardware_concurrency(), 1);
+  const GLint steps = 600;
+  printf("threads\tbodies\tms/step\n");
+  for (GLint bodies = 1000; bodies <= 4000; bodies *= 2) {
+    for (GLint threads = 1; threads <= maxThreads; threads *= 2) {
+      const GLfloat time = measure(threads, bodies, steps);
+      if (time < 0.0) {
+        printf("%d\t%d\tunsupported\n", threads, bodies);
+        break;
+      }
+      printf("%d\t%d\t%.3f\n", threads, bodies, time);
+    }
+  }
+}
+
+GLfloat PhysicsBenchmark::measure(const GLint threads, const GLint bodies, const GLint steps) {
+  Physics physics;
+  if (!physics.setThreads(threads)) {
+    return -1.0;
+  }
+
+  std::vector<btRigidBody*> created;
+  const glm::quat rotation(1.0, 0.0, 0.0, 0.0);
+  const glm::vec3 unit(1.0);
+  created.push_back(physics.addBody(
+    { { GEOMETRY_COLLIDER_BOX, glm::vec3(0.0), glm::vec3(1.0) } },
+    glm::vec3(0.0, -0.5, 0.0), rotation, glm::vec3(256.0, 1.0, 256.0)
+  ));
+  const std::vector<GeometryCollider> box = { { GEOMETRY_COLLIDER_BOX, glm::vec3(0.0), unit } };
+  const std::vector<GeometryCollider> sphere = { { GEOMETRY_COLLIDER_SPHERE, glm::vec3(0.0), unit } };
+  // Unit colliders are 2 units wide, so this leaves a gap between them
+  const GLfloat spacing = 2.2;
+  const GLint side = (GLint) glm::ceil(glm::sqrt((GLfloat) bodies / 4.0));
+  for (GLint i = 0; i < bodies; i++) {
+    const GLint layer = i / (side * side);
+    const GLint x = i % side;
+    const GLint z = (i / side) % side;
+    const glm::vec3 position(
+      (x - side * 0.5) * spacing + (layer % 2) * 0.5,
+      2.0 + layer * spacing,
+      (z - side * 0.5) * spacing
+    );
+    created.push_back(physics.addBody(i % 2 ? sphere : box, position, rotation, unit, 1.0));
+  }
+
+  // Warm up so the pile has settled into contact before timing
+  for (GLint i = 0; i < 60; i++) {
+    physics.step(1.0 / 60.0);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  for (GLint i = 0; i < steps; i++) {
+    physics.step(1.0 / 60.0);
+  }
+  const std::chrono::duration<GLfloat, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+  for (auto body : created) {
+    physics.removeBody(body);
+  }
+  return elapsed.count() / (GLfloat) steps;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <glad/glad.h>
+
+class PhysicsBenchmark {
+  public:
+    static void run();
+  private:
+    static GLfloat measure(const GLint threads, const GLint bodies, const GLint steps);
+};
@@ -0,0 +1,81 @@
+#include "cache.hpp"
+#include <cstdlib>
+#include <fstream>
+
+uint64_t Cache::hash(const void* data, const size_t size, const uint64_t seed) {
+  // FNV-1a
+  const unsigned char* bytes = (const unsigned char*) data;
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string Cache::key(const uint64_t hash) {
+  static const char digits[] = "0123456789abcdef";
+  std::string key(16, '0');
+  for (int i = 15, h = 0; i >= 0; i--, h += 4) {
+    key[i] = digits[(hash >> h) & 0xF];
+  }
+  return key;
+}
+
+bool Cache::read(const std::string& bucket, const std::string& key, std::vector<char>& data) {
+  std::ifstream stream(getPath(bucket, key), std::ios::binary | std::ios::ate);
+  if (!stream.good()) {
+    return false;
+  }
+  const std::streamsize size = stream.tellg();
+  if (size <= 0) {
+    return false;
+  }
+  data.resize(size);
+  stream.seekg(0);
+  return stream.read(data.data(), size).good();
+}
+
+void Cache::write(const std::string& bucket, const std::string& key, const void* data, const size_t size) {
+  const std::filesystem::path path = getPath(bucket, key);
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  if (error) {
+    return;
+  }
+  // Write to a temporary file first so a crash never leaves a truncated entry
+  std::filesystem::path temp = path;
+  temp += ".tmp";
+  {
+    std::ofstream stream(temp, std::ios::binary | std::ios::trunc);
+    if (!stream.write((const char*) data, size).good()) {
+      stream.close();
+      std::filesystem::remove(temp, error);
+      return;
+    }
+  }
+  std::filesystem::rename(temp, path, error);
+}
+
+std::filesystem::path Cache::getPath(const std::string& bucket, const std::string& key) {
+  static const std::filesystem::path root = []() {
+#ifdef _WIN32
+    const char* base = std::getenv("LOCALAPPDATA");
+    if (base != nullptr) {
+      return std::filesystem::path(base) / "navigator";
+    }
+#else
+    const char* base = std::getenv("XDG_CACHE_HOME");
+    if (base != nullptr) {
+      return std::filesystem::path(base) / "navigator";
+    }
+    const char* home = std::getenv("HOME");
+    if (home != nullptr) {
+      return std::filesystem::path(home) / ".cache" / "navigator";
+    }
+#endif
+    std::error_code error;
+    return std::filesystem::temp_directory_path(error) / "navigator";
+  }();
+  return root / bucket / key;
+}
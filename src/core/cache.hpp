@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Best effort on-disk cache for derived data (BVHs, program binaries...).
+// Entries are keyed by a content hash so they never need invalidation.
+class Cache {
+  public:
+    static uint64_t hash(const void* data, const size_t size, const uint64_t seed = 14695981039346656037ull);
+    static std::string key(const uint64_t hash);
+    static bool read(const std::string& bucket, const std::string& key, std::vector<char>& data);
+    static void write(const std::string& bucket, const std::string& key, const void* data, const size_t size);
+  private:
+    static std::filesystem::path getPath(const std::string& bucket, const std::string& key);
+};
@@ -0,0 +1,57 @@
+#include "character.hpp"
+
+Character::Character(Physics* physics, const GLfloat radius, const GLfloat height, const GLfloat stepHeight, const GLfloat maxSlope):
+  physics(physics),
+  shape(radius, height),
+  ghost(),
+  controller(&ghost, &shape, stepHeight, btVector3(0, 1, 0)),
+  velocity(0.0, 0.0, 0.0)
+{
+  btTransform transform;
+  transform.setIdentity();
+  ghost.setWorldTransform(transform);
+  ghost.setCollisionShape(&shape);
+  ghost.setCollisionFlags(btCollisionObject::CF_CHARACTER_OBJECT);
+  controller.setMaxSlope(glm::radians(maxSlope));
+  physics->addCharacter(this);
+}
+
+Character::~Character() {
+  physics->removeCharacter(this);
+}
+
+btKinematicCharacterController* Character::getController() {
+  return &controller;
+}
+
+btPairCachingGhostObject* Character::getGhost() {
+  return &ghost;
+}
+
+glm::vec3 Character::getPosition() {
+  const btVector3& origin = ghost.getWorldTransform().getOrigin();
+  return glm::vec3(origin.x(), origin.y(), origin.z());
+}
+
+void Character::setPosition(const glm::vec3& position) {
+  controller.warp(btVector3(position.x, position.y, position.z));
+  controller.reset(physics->getWorld());
+}
+
+const glm::vec3& Character::getVelocity() {
+  return velocity;
+}
+
+void Character::setVelocity(const glm::vec3& value) {
+  velocity = value;
+}
+
+bool Character::isOnGround() {
+  return controller.onGround();
+}
+
+void Character::jump(const GLfloat speed) {
+  if (controller.canJump()) {
+    controller.jump(btVector3(0, speed, 0));
+  }
+}
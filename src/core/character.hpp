@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <btBulletDynamicsCommon.h>
+#include <BulletCollision/CollisionDispatch/btGhostObject.h>
+#include <BulletDynamics/Character/btKinematicCharacterController.h>
+#include "physics.hpp"
+
+class Character {
+  public:
+    Character(Physics* physics, const GLfloat radius, const GLfloat height, const GLfloat stepHeight, const GLfloat maxSlope);
+    ~Character();
+    btKinematicCharacterController* getController();
+    btPairCachingGhostObject* getGhost();
+    glm::vec3 getPosition();
+    void setPosition(const glm::vec3& position);
+    const glm::vec3& getVelocity();
+    void setVelocity(const glm::vec3& velocity);
+    bool isOnGround();
+    void jump(const GLfloat speed);
+  private:
+    Physics* physics;
+    btCapsuleShape shape;
+    btPairCachingGhostObject ghost;
+    btKinematicCharacterController controller;
+    glm::vec3 velocity;
+};
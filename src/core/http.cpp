@@ -65,6 +65,13 @@ void HTTP::update() {
       request->curl = nullptr;
       request->handler = nullptr;
       request->isReady = true;
+      if (request->onReady) {
+        // The callback can hand the request to a worker that frees it,
+        // so it can't run from inside the request.
+        std::function<void()> onReady = std::move(request->onReady);
+        request->onReady = nullptr;
+        onReady();
+      }
     }
   }
 }
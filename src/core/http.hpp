@@ -1,6 +1,7 @@
 #pragma once
 
 #include <curl/curl.h>
+#include <functional>
 #include <string>
 
 struct HTTPResponse {
@@ -18,6 +19,8 @@ class HTTPRequest {
     struct curl_slist *headers;
     CURLM* handler;
     HTTPResponse response;
+    // Called from HTTP::update once the response is complete
+    std::function<void()> onReady;
 };
 
 class HTTP {
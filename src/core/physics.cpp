@@ -1,5 +1,11 @@
 #include "physics.hpp"
+#include "cache.hpp"
+#include "character.hpp"
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <glm/gtc/type_ptr.hpp>
 
 enum PhysicsBodyPointerType {
   PHYSICS_BODY_POINTER_MESH,
@@ -11,50 +17,119 @@ struct PhysicsBodyPointer {
   void* pointer;
 };
 
-Physics::Physics() {
+// Chunk bodies are only created within this distance of a
+// non-static body or a query, and dropped after being unused for a while.
+static const btScalar chunkMargin = 2.0;
+static const GLuint chunkLifetime = 120;
+
+class PhysicsMotionState: public btMotionState {
+  public:
+    btRigidBody* body;
+    Mesh* mesh;
+    bool isActive;
+    PhysicsMotionState(std::vector<PhysicsMotionState*>* active, const btTransform& transform):
+      active(active),
+      body(nullptr),
+      current(transform),
+      isActive(false),
+      mesh(nullptr),
+      previous(transform)
+    {
+
+    }
+    void getWorldTransform(btTransform& transform) const {
+      transform = current;
+    }
+    void setWorldTransform(const btTransform& transform) {
+      // Bullet calls this for active dynamic bodies on every stepSimulation,
+      // even when no substep ran. The transform it passes is already interpolated,
+      // so this keeps the raw state instead. The previous one is captured before each substep.
+      current = body->getWorldTransform();
+      if (!isActive && mesh != nullptr) {
+        isActive = true;
+        active->push_back(this);
+      }
+    }
+    void capture() {
+      previous = body->getWorldTransform();
+    }
+    void reset(const btTransform& transform) {
+      previous = current = transform;
+    }
+    void sync(const btScalar alpha) {
+      const btVector3 origin = previous.getOrigin().lerp(current.getOrigin(), alpha);
+      const btQuaternion rotation = previous.getRotation().slerp(current.getRotation(), alpha);
+      mesh->setPosition(glm::vec3(origin.x(), origin.y(), origin.z()));
+      mesh->setRotation(glm::quat(rotation.w(), rotation.x(), rotation.y(), rotation.z()));
+    }
+  private:
+    std::vector<PhysicsMotionState*>* active;
+    btTransform current;
+    btTransform previous;
+};
+
+Physics::Physics():
+  accumulator(0.0),
+  frame(0),
+  maxSubSteps(8),
+  needsActiveReset(false),
+  threads(1),
+  timestep(1.0 / 60.0),
+  dispatcher(nullptr),
+  solver(nullptr),
+  solverPool(nullptr),
+  dynamicsWorld(nullptr)
+{
   collisionConfiguration = new btDefaultCollisionConfiguration();
-  dispatcher = new btCollisionDispatcher(collisionConfiguration);
   broadphase = new btDbvtBroadphase();
-  solver = new btSequentialImpulseConstraintSolver();
-  dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher, broadphase, solver, collisionConfiguration);
+  broadphase->getOverlappingPairCache()->setInternalGhostPairCallback(&ghostPairCallback);
+  createWorld();
+}
+
+Physics::~Physics() {
+  if (ghost.getCollisionShape() != nullptr) {
+    gcShape(ghost.getCollisionShape());
+    ghost.setCollisionShape(nullptr);
+  }
+  delete dynamicsWorld;
+  delete solverPool;
+  delete solver;
+  delete dispatcher;
+  delete broadphase;
+  delete collisionConfiguration;
 }
 
 void Physics::step(GLfloat delta) {
-  dynamicsWorld->stepSimulation(delta);
-  std::vector<btRigidBody*> updated;
-  for (int i = dynamicsWorld->getNumCollisionObjects() - 1; i >= 0; i--) {
-    btCollisionObject* obj = dynamicsWorld->getCollisionObjectArray()[i];
-    btRigidBody* body = btRigidBody::upcast(obj);
-    if (body && body->getUserPointer()) {
-      PhysicsBodyPointer* p = (PhysicsBodyPointer*) body->getUserPointer();
-      switch (p->type) {
-        case PHYSICS_BODY_POINTER_MESH:
-          if (!body->isStaticOrKinematicObject() && body->getMotionState()) {
-            btDefaultMotionState* ms = (btDefaultMotionState*) body->getMotionState();
-            ms->getWorldTransform(transform);
-            const btVector3& origin = transform.getOrigin();
-            const btQuaternion& rotation = transform.getRotation();
-            Mesh* mesh = (Mesh*) p->pointer;
-            mesh->setPosition(glm::vec3(origin.x(), origin.y(), origin.z()));
-            mesh->setRotation(glm::quat(rotation.w(), rotation.x(), rotation.y(), rotation.z()));
-          }
-          break;
-        case PHYSICS_BODY_POINTER_VOXEL_CHUNK: {
-          VoxelChunk* chunk = (VoxelChunk*) p->pointer;
-          if (chunk->needsCollidersUpdate) {
-            chunk->updateColliders();
-            updated.push_back(body);
-          }
-          break;
-        }
-      }
+  // Bullet runs the fixed substeps and drops the ones over maxSubSteps.
+  // This mirrors its accumulator so meshes can be interpolated with the remainder.
+  updateChunks();
+  // The begin/end events come from the substeps of this frame only. The pairs
+  // still touching (that didn't just begin) persist, even if nothing stepped.
+  contactEvents.clear();
+  contactBegins.clear();
+  needsActiveReset = true;
+  dynamicsWorld->stepSimulation(delta, maxSubSteps, timestep);
+  needsActiveReset = false;
+  for (const auto& [pair, flags] : contactPairs) {
+    if (!contactBegins.contains(pair)) {
+      contactEvents.push_back({ PHYSICS_CONTACT_PERSIST, pair.first, pair.second, flags });
     }
   }
-  for (const auto& body : updated) {
-    PhysicsBodyPointer* p = (PhysicsBodyPointer*) body->getUserPointer();
-    VoxelChunk* chunk = (VoxelChunk*) p->pointer;
-    removeBody(body);
-    addBody(chunk);
+  accumulator += delta;
+  if (accumulator >= timestep) {
+    accumulator -= int(accumulator / timestep) * timestep;
+  }
+  const GLfloat alpha = glm::clamp((GLfloat) (accumulator / timestep), (GLfloat) 0.0, (GLfloat) 1.0);
+  for (const auto& motionState : active) {
+    motionState->sync(alpha);
+  }
+  if (!dirtyChunks.empty()) {
+    std::vector<VoxelChunk*> chunks;
+    chunks.swap(dirtyChunks);
+    for (const auto& chunk : chunks) {
+      chunk->needsCollidersUpdate = false;
+      refreshContacts(chunk->getBody());
+    }
   }
 }
 
@@ -66,22 +141,69 @@ void Physics::addBody(Mesh* mesh, const GLfloat mass, const bool isAlwaysActive,
     mesh->getScale(),
     mass,
     isAlwaysActive,
-    isKinematic
+    isKinematic,
+    mesh->getGeometry()
   );
   body->setUserPointer((void*) new PhysicsBodyPointer({
     PHYSICS_BODY_POINTER_MESH,
     (void*) mesh
   }));
+  ((PhysicsMotionState*) body->getMotionState())->mesh = mesh;
   mesh->setBody(body);
 }
 
 void Physics::addBody(VoxelChunk* chunk) {
-  btRigidBody* body = addBody(
-    chunk->colliders,
-    chunk->getPosition(),
-    glm::quat(1.0, 0.0, 0.0, 0.0),
-    glm::vec3(1.0, 1.0, 1.0)
+  lazyChunks[getChunkKey(chunk)].push_back(chunk);
+}
+
+void Physics::removeBody(VoxelChunk* chunk) {
+  auto entry = lazyChunks.find(getChunkKey(chunk));
+  if (entry != lazyChunks.end()) {
+    std::erase(entry->second, chunk);
+    if (entry->second.empty()) {
+      lazyChunks.erase(entry);
+    }
+  }
+  if (chunk->getBody() != nullptr) {
+    removeBody(chunk->getBody());
+  }
+}
+
+void Physics::addCharacter(Character* character) {
+  const btVector3& gravity = dynamicsWorld->getGravity();
+  character->getController()->setGravity(gravity);
+  dynamicsWorld->addCollisionObject(
+    character->getGhost(),
+    btBroadphaseProxy::CharacterFilter,
+    btBroadphaseProxy::StaticFilter | btBroadphaseProxy::DefaultFilter
   );
+  dynamicsWorld->addAction(character->getController());
+  characters.push_back(character);
+}
+
+void Physics::removeCharacter(Character* character) {
+  dynamicsWorld->removeAction(character->getController());
+  dynamicsWorld->removeCollisionObject(character->getGhost());
+  std::erase(characters, character);
+}
+
+btDiscreteDynamicsWorld* Physics::getWorld() {
+  return dynamicsWorld;
+}
+
+void Physics::loadChunk(VoxelChunk* chunk) {
+  loadedChunks[chunk] = frame;
+  if (chunk->getBody() != nullptr) {
+    return;
+  }
+  const glm::vec3& position = chunk->getPosition();
+  transform.setIdentity();
+  transform.setOrigin(btVector3(position.x, position.y, position.z));
+  btRigidBody::btRigidBodyConstructionInfo cInfo(0.0, nullptr, new VoxelCollider(chunk));
+  cInfo.m_startWorldTransform = transform;
+  btRigidBody* body = new btRigidBody(cInfo);
+  dynamicsWorld->addRigidBody(body);
+  chunk->needsCollidersUpdate = false;
   body->setUserPointer((void*) new PhysicsBodyPointer({
     PHYSICS_BODY_POINTER_VOXEL_CHUNK,
     (void*) chunk
@@ -89,13 +211,12 @@ void Physics::addBody(VoxelChunk* chunk) {
   chunk->setBody(body);
 }
 
-btRigidBody* Physics::addBody(const std::vector<GeometryCollider>& colliders, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, const GLfloat mass, const bool isAlwaysActive, const bool isKinematic) {
-  btCompoundShape* shape = new btCompoundShape();
-  for (const auto& collider : colliders) {
-    transform.setIdentity();
-    transform.setOrigin(btVector3(collider.position.x, collider.position.y, collider.position.z));
-    shape->addChildShape(transform, getColliderShape(collider.shape, collider.scale * scale));
-  }
+btRigidBody* Physics::addBody(const std::vector<GeometryCollider>& colliders, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, const GLfloat bodyMass, const bool isAlwaysActive, const bool isKinematic, Geometry* geometry) {
+  btCollisionShape* shape = getCompoundShape(colliders, scale, geometry);
+  // Scaled triangle meshes inside a compound only work on static bodies
+  const GLfloat mass = std::any_of(colliders.begin(), colliders.end(), [](const GeometryCollider& collider) {
+    return collider.shape == GEOMETRY_COLLIDER_MESH;
+  }) ? 0.0 : bodyMass;
   const bool isDynamic = mass != 0.0;
   btVector3 localInertia(0, 0, 0);
   if (isDynamic) {
@@ -104,9 +225,10 @@ btRigidBody* Physics::addBody(const std::vector<GeometryCollider>& colliders, co
   transform.setIdentity();
   transform.setOrigin(btVector3(position.x, position.y, position.z));
   transform.setRotation(btQuaternion(rotation.x, rotation.y, rotation.z, rotation.w));
-  btDefaultMotionState* ms = new btDefaultMotionState(transform);
+  PhysicsMotionState* ms = new PhysicsMotionState(&active, transform);
   btRigidBody::btRigidBodyConstructionInfo cInfo(mass, ms, shape, localInertia);
   btRigidBody* body = new btRigidBody(cInfo);
+  ms->body = body;
   if (isAlwaysActive) {
     body->setActivationState(DISABLE_DEACTIVATION);
   }
@@ -125,35 +247,176 @@ void Physics::removeBody(btRigidBody* body) {
         ((Mesh*) p->pointer)->setBody(nullptr);
         break;
       case PHYSICS_BODY_POINTER_VOXEL_CHUNK:
+        std::erase(dirtyChunks, (VoxelChunk*) p->pointer);
+        loadedChunks.erase((VoxelChunk*) p->pointer);
         ((VoxelChunk*) p->pointer)->setBody(nullptr);
         break;
     }
     delete p;
   }
   if (body->getMotionState()) {
-    delete body->getMotionState();
+    PhysicsMotionState* ms = (PhysicsMotionState*) body->getMotionState();
+    if (ms->isActive) {
+      std::erase(active, ms);
+    }
+    delete ms;
   }
+  std::erase_if(contacts, [body](const PhysicsContact& contact) {
+    return contact.bodyA == body || contact.bodyB == body;
+  });
+  dynamicsWorld->removeRigidBody(body);
   if (body->getCollisionShape()) {
-    btCollisionShape* shape = body->getCollisionShape();
-    if (shape->isCompound()) {
-      btCompoundShape* compound = (btCompoundShape*) shape;
-      for (int i = 0, l = compound->getNumChildShapes(); i < l; i++) {
-        delete compound->getChildShape(i);
+    gcShape(body->getCollisionShape());
+  }
+  delete body;
+}
+
+void Physics::loadChunks(const btVector3& aabbMin, const btVector3& aabbMax) {
+  if (lazyChunks.empty()) {
+    return;
+  }
+  const GLfloat size = VoxelChunk::size;
+  const glm::ivec3 from(glm::floor((glm::vec3(aabbMin.x(), aabbMin.y(), aabbMin.z()) + size * (GLfloat) 0.5) / size));
+  const glm::ivec3 to(glm::floor((glm::vec3(aabbMax.x(), aabbMax.y(), aabbMax.z()) + size * (GLfloat) 0.5) / size));
+  const glm::vec3 span = glm::vec3(to - from) + (GLfloat) 1.0;
+  if (span.x * span.y * span.z > (GLfloat) lazyChunks.size()) {
+    // Bigger than the registered chunks. Walk those instead.
+    for (const auto& [key, chunks] : lazyChunks) {
+      const auto& [x, y, z] = key;
+      if (
+        x >= from.x && x <= to.x
+        && y >= from.y && y <= to.y
+        && z >= from.z && z <= to.z
+      ) {
+        for (const auto& chunk : chunks) {
+          loadChunk(chunk);
+        }
       }
     }
-    delete shape;
+    return;
+  }
+  for (GLint z = from.z; z <= to.z; z++) {
+    for (GLint y = from.y; y <= to.y; y++) {
+      for (GLint x = from.x; x <= to.x; x++) {
+        auto entry = lazyChunks.find(PhysicsChunkKey(x, y, z));
+        if (entry != lazyChunks.end()) {
+          for (const auto& chunk : entry->second) {
+            loadChunk(chunk);
+          }
+        }
+      }
+    }
+  }
+}
+
+void Physics::loadChunksAlongRay(const btVector3& from, const btVector3& to) {
+  if (lazyChunks.empty()) {
+    return;
+  }
+  // Walks the chunk grid cells crossed by the segment
+  const GLfloat size = VoxelChunk::size;
+  const glm::vec3 origin = (glm::vec3(from.x(), from.y(), from.z()) + size * (GLfloat) 0.5) / size;
+  const glm::vec3 target = (glm::vec3(to.x(), to.y(), to.z()) + size * (GLfloat) 0.5) / size;
+  const glm::vec3 direction = target - origin;
+  const glm::ivec3 end(glm::floor(target));
+  glm::ivec3 cell(glm::floor(origin));
+  glm::ivec3 step;
+  glm::vec3 delta, next;
+  for (GLint i = 0; i < 3; i++) {
+    if (direction[i] > 0.0) {
+      step[i] = 1;
+      delta[i] = 1.0 / direction[i];
+      next[i] = (cell[i] + 1.0 - origin[i]) * delta[i];
+    } else if (direction[i] < 0.0) {
+      step[i] = -1;
+      delta[i] = -1.0 / direction[i];
+      next[i] = (origin[i] - cell[i]) * delta[i];
+    } else {
+      step[i] = 0;
+      delta[i] = next[i] = std::numeric_limits<GLfloat>::max();
+    }
+  }
+  const glm::ivec3 distance = glm::abs(end - cell);
+  for (GLint i = 0, l = distance.x + distance.y + distance.z; i <= l; i++) {
+    auto entry = lazyChunks.find(PhysicsChunkKey(cell.x, cell.y, cell.z));
+    if (entry != lazyChunks.end()) {
+      for (const auto& chunk : entry->second) {
+        loadChunk(chunk);
+      }
+    }
+    const GLint axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+    cell[axis] += step[axis];
+    next[axis] += delta[axis];
+  }
+}
+
+void Physics::updateChunks() {
+  frame++;
+  if (loadedChunks.empty() && lazyChunks.empty()) {
+    return;
+  }
+  // Sleeping bodies don't move, so only the active ones (and the kinematic
+  // ones the scripts move around) can reach new chunks
+  btAlignedObjectArray<btRigidBody*>& bodies = dynamicsWorld->getNonStaticRigidBodies();
+  for (int i = 0; i < bodies.size(); i++) {
+    btRigidBody* body = bodies[i];
+    if (!body->isActive() && !body->isKinematicObject()) {
+      continue;
+    }
+    const btScalar reach = chunkMargin + body->getLinearVelocity().length() * timestep * maxSubSteps;
+    const btBroadphaseProxy* proxy = body->getBroadphaseHandle();
+    loadChunks(
+      proxy->m_aabbMin - btVector3(reach, reach, reach),
+      proxy->m_aabbMax + btVector3(reach, reach, reach)
+    );
+  }
+  for (const auto& character : characters) {
+    const btBroadphaseProxy* proxy = character->getGhost()->getBroadphaseHandle();
+    loadChunks(
+      proxy->m_aabbMin - btVector3(chunkMargin, chunkMargin, chunkMargin),
+      proxy->m_aabbMax + btVector3(chunkMargin, chunkMargin, chunkMargin)
+    );
+  }
+  std::vector<VoxelChunk*> expired;
+  for (auto& [chunk, lastUsed] : loadedChunks) {
+    if (frame - lastUsed <= chunkLifetime) {
+      continue;
+    }
+    // Keep the ones still holding up a sleeping body
+    if (isSupporting(chunk->getBody())) {
+      lastUsed = frame;
+      continue;
+    }
+    expired.push_back(chunk);
+  }
+  for (const auto& chunk : expired) {
+    removeBody(chunk->getBody());
   }
-  dynamicsWorld->removeRigidBody(body);
-  delete body;
+}
+
+bool Physics::isSupporting(btRigidBody* chunk) {
+  struct Callback : public btBroadphaseAabbCallback {
+    bool found = false;
+    virtual bool process(const btBroadphaseProxy* proxy) {
+      const btCollisionObject* object = (const btCollisionObject*) proxy->m_clientObject;
+      found = !object->isStaticObject() && btRigidBody::upcast(object) != nullptr;
+      return !found;
+    }
+  };
+  const btBroadphaseProxy* proxy = chunk->getBroadphaseHandle();
+  Callback cb;
+  broadphase->aabbTest(proxy->m_aabbMin, proxy->m_aabbMax, cb);
+  return cb.found;
 }
 
 void Physics::setBodyPosition(btRigidBody* body, const glm::vec3& position) {
   if (!body->getMotionState()) {
     return;
   }
-  body->getMotionState()->getWorldTransform(transform);
+  PhysicsMotionState* ms = (PhysicsMotionState*) body->getMotionState();
+  ms->getWorldTransform(transform);
   transform.setOrigin(btVector3(position.x, position.y, position.z));
-  body->getMotionState()->setWorldTransform(transform);
+  ms->reset(transform);
   body->setWorldTransform(transform);
 }
 
@@ -161,12 +424,100 @@ void Physics::setBodyRotation(btRigidBody* body, const glm::quat& rotation) {
   if (!body->getMotionState()) {
     return;
   }
-  body->getMotionState()->getWorldTransform(transform);
+  PhysicsMotionState* ms = (PhysicsMotionState*) body->getMotionState();
+  ms->getWorldTransform(transform);
   transform.setRotation(btQuaternion(rotation.x, rotation.y, rotation.z, rotation.w));
-  body->getMotionState()->setWorldTransform(transform);
+  ms->reset(transform);
   body->setWorldTransform(transform);
 }
 
+void Physics::preTickCallback(btDynamicsWorld* world, btScalar timeStep) {
+  Physics* physics = (Physics*) world->getWorldUserInfo();
+  for (const auto& character : physics->characters) {
+    const glm::vec3 step = character->getVelocity() * (GLfloat) timeStep;
+    character->getController()->setWalkDirection(btVector3(step.x, step.y, step.z));
+  }
+  // Meshes interpolate from the state before the last substep
+  btAlignedObjectArray<btRigidBody*>& bodies = ((btDiscreteDynamicsWorld*) world)->getNonStaticRigidBodies();
+  for (int i = 0; i < bodies.size(); i++) {
+    PhysicsMotionState* motionState = (PhysicsMotionState*) bodies[i]->getMotionState();
+    if (motionState != nullptr && motionState->mesh != nullptr) {
+      motionState->capture();
+    }
+  }
+  if (!physics->needsActiveReset) {
+    return;
+  }
+  // First substep of this frame: only the bodies that move from here on need syncing
+  physics->needsActiveReset = false;
+  for (const auto& motionState : physics->active) {
+    motionState->isActive = false;
+  }
+  physics->active.clear();
+}
+
+void Physics::queueCollidersUpdate(VoxelChunk* chunk) {
+  if (chunk->getBody() != nullptr) {
+    dirtyChunks.push_back(chunk);
+  } else {
+    chunk->needsCollidersUpdate = false;
+  }
+}
+
+void Physics::refreshContacts(btRigidBody* body) {
+  // The voxel shape has no state to rebuild. Wake up whatever is touching
+  // it and drop the cached manifolds so contacts on removed voxels go away.
+  // Only the proxies overlapping the chunk are looked up, not every pair.
+  struct Callback : public btBroadphaseAabbCallback {
+    btBroadphaseProxy* proxy;
+    btOverlappingPairCache* pairs;
+    btDispatcher* dispatcher;
+    Callback(btBroadphaseProxy* proxy, btOverlappingPairCache* pairs, btDispatcher* dispatcher) : proxy(proxy), pairs(pairs), dispatcher(dispatcher) {}
+    virtual bool process(const btBroadphaseProxy* other) {
+      if (other == proxy) {
+        return true;
+      }
+      btBroadphasePair* pair = pairs->findPair(proxy, (btBroadphaseProxy*) other);
+      if (pair != nullptr) {
+        ((btCollisionObject*) other->m_clientObject)->activate(true);
+        pairs->cleanOverlappingPair(*pair, dispatcher);
+      }
+      return true;
+    }
+  };
+  btBroadphaseProxy* proxy = body->getBroadphaseHandle();
+  Callback cb(proxy, broadphase->getOverlappingPairCache(), dispatcher);
+  broadphase->aabbTest(proxy->m_aabbMin, proxy->m_aabbMax, cb);
+}
+
+std::string Physics::getMeshKey(Geometry* geometry) {
+  // The serialized BVH layout depends on the bullet build
+  const GLuint build[] = { BT_BULLET_VERSION, sizeof(btScalar), sizeof(void*) };
+  uint64_t hash = Cache::hash(build, sizeof(build));
+  for (const auto& vertex : geometry->vertices) {
+    hash = Cache::hash(glm::value_ptr(vertex.position), sizeof(glm::vec3), hash);
+  }
+  hash = Cache::hash(geometry->index.data(), sizeof(GLushort) * geometry->index.size(), hash);
+  return Cache::key(hash);
+}
+
+GLuint Physics::getKeyBits(const GLfloat value) {
+  // -0.0 and the NaN payloads would otherwise key the same shape differently
+  GLfloat normalized = value == 0.0 ? 0.0 : value;
+  if (std::isnan(normalized)) {
+    normalized = std::numeric_limits<GLfloat>::quiet_NaN();
+  }
+  GLuint bits;
+  std::memcpy(&bits, &normalized, sizeof(GLuint));
+  return bits;
+}
+
+PhysicsChunkKey Physics::getChunkKey(VoxelChunk* chunk) {
+  const GLfloat size = VoxelChunk::size;
+  const glm::ivec3 key(glm::round((chunk->getPosition() + size * (GLfloat) 0.5) / size));
+  return PhysicsChunkKey(key.x, key.y, key.z);
+}
+
 bool Physics::getBodyData(btCollisionObject* target, GLuint& id, GLbyte& flags) {
   btRigidBody* body = btRigidBody::upcast(target);
   if (!body || !body->getUserPointer()) {
@@ -190,6 +541,15 @@ bool Physics::getBodyData(btCollisionObject* target, GLuint& id, GLbyte& flags)
   return true;
 }
 
+bool Physics::isQueryable(btBroadphaseProxy* proxy, const GLubyte mask) {
+  GLuint id;
+  GLbyte flags;
+  return (
+    getBodyData((btCollisionObject*) proxy->m_clientObject, id, flags)
+    && (mask == 0 || (flags & mask))
+  );
+}
+
 btCollisionShape* Physics::getColliderShape(const GeometryColliderShape shape, const glm::vec3& scale) {
   switch (shape) {
     default:
@@ -204,19 +564,294 @@ btCollisionShape* Physics::getColliderShape(const GeometryColliderShape shape, c
   }
 }
 
+btCollisionShape* Physics::getCompoundShape(const std::vector<GeometryCollider>& colliders, const glm::vec3& scale, Geometry* geometry) {
+  std::string key;
+  const auto append = [&key](const GLuint value) {
+    key.append((const char*) &value, sizeof(GLuint));
+  };
+  for (GLint i = 0; i < 3; i++) {
+    append(getKeyBits(scale[i]));
+  }
+  for (const auto& collider : colliders) {
+    append(collider.shape);
+    for (GLint i = 0; i < 3; i++) {
+      append(getKeyBits(collider.position[i]));
+      append(getKeyBits(collider.scale[i]));
+    }
+  }
+  const bool hasMesh = (
+    geometry != nullptr
+    && geometry->index.size() >= 3
+    && std::any_of(colliders.begin(), colliders.end(), [](const GeometryCollider& collider) {
+      return collider.shape == GEOMETRY_COLLIDER_MESH;
+    })
+  );
+  if (hasMesh) {
+    // The geometry id and version find the compound without hashing the triangles.
+    // The content hash is only needed to share the mesh shape and its BVH.
+    append(geometry->id);
+    append(geometry->getVersion());
+  }
+  auto [entry, isNew] = compoundShapes.try_emplace(key, PhysicsSharedShape({ nullptr, 0 }));
+  if (isNew) {
+    const std::string meshKey = hasMesh ? getMeshKey(geometry) : "";
+    btCompoundShape* compound = new btCompoundShape();
+    for (const auto& collider : colliders) {
+      transform.setIdentity();
+      transform.setOrigin(btVector3(collider.position.x, collider.position.y, collider.position.z));
+      if (collider.shape == GEOMETRY_COLLIDER_MESH) {
+        if (meshKey.empty()) {
+          continue;
+        }
+        const glm::vec3 meshScale = collider.scale * scale;
+        compound->addChildShape(transform, new btScaledBvhTriangleMeshShape(
+          getSharedMeshShape(geometry, meshKey),
+          btVector3(meshScale.x, meshScale.y, meshScale.z)
+        ));
+        continue;
+      }
+      compound->addChildShape(transform, getSharedColliderShape(collider.shape, collider.scale * scale));
+    }
+    compound->setUserPointer((void*) &entry->first);
+    entry->second.shape = compound;
+  }
+  entry->second.refs++;
+  return entry->second.shape;
+}
+
+btCollisionShape* Physics::getSharedColliderShape(const GeometryColliderShape shape, const glm::vec3& scale) {
+  const PhysicsSharedShapeKey key(shape, getKeyBits(scale.x), getKeyBits(scale.y), getKeyBits(scale.z));
+  auto [entry, isNew] = colliderShapes.try_emplace(key, PhysicsSharedShape({ nullptr, 0 }));
+  if (isNew) {
+    entry->second.shape = getColliderShape(shape, scale);
+    entry->second.shape->setUserPointer((void*) &entry->first);
+  }
+  entry->second.refs++;
+  return entry->second.shape;
+}
+
+btBvhTriangleMeshShape* Physics::getSharedMeshShape(Geometry* geometry, const std::string& key) {
+  auto [entry, isNew] = meshShapes.try_emplace(key, PhysicsMeshShape({ nullptr, nullptr, nullptr, 0 }));
+  if (isNew) {
+    btTriangleMesh* mesh = new btTriangleMesh();
+    mesh->preallocateVertices(geometry->vertices.size());
+    mesh->preallocateIndices(geometry->index.size());
+    for (const auto& vertex : geometry->vertices) {
+      mesh->findOrAddVertex(btVector3(vertex.position.x, vertex.position.y, vertex.position.z), false);
+    }
+    for (size_t i = 0; i + 2 < geometry->index.size(); i += 3) {
+      mesh->addTriangleIndices(geometry->index[i], geometry->index[i + 1], geometry->index[i + 2]);
+    }
+    btBvhTriangleMeshShape* shape = nullptr;
+    std::vector<char> data;
+    if (Cache::read("bvh", key, data)) {
+      void* buffer = btAlignedAlloc(data.size(), 16);
+      memcpy(buffer, data.data(), data.size());
+      btOptimizedBvh* bvh = btOptimizedBvh::deSerializeInPlace(buffer, data.size(), false);
+      if (bvh != nullptr) {
+        shape = new btBvhTriangleMeshShape(mesh, true, false);
+        shape->setOptimizedBvh(bvh);
+        entry->second.bvh = buffer;
+      } else {
+        btAlignedFree(buffer);
+      }
+    }
+    if (shape == nullptr) {
+      shape = new btBvhTriangleMeshShape(mesh, true, true);
+      const btOptimizedBvh* bvh = shape->getOptimizedBvh();
+      const unsigned int size = bvh->calculateSerializeBufferSize();
+      void* buffer = btAlignedAlloc(size, 16);
+      if (bvh->serializeInPlace(buffer, size, false)) {
+        Cache::write("bvh", key, buffer, size);
+      }
+      btAlignedFree(buffer);
+    }
+    shape->setUserPointer((void*) &entry->first);
+    entry->second.shape = shape;
+    entry->second.mesh = mesh;
+  }
+  entry->second.refs++;
+  return entry->second.shape;
+}
+
+void Physics::gcShape(btCollisionShape* shape) {
+  if (shape->getShapeType() == SCALED_TRIANGLE_MESH_SHAPE_PROXYTYPE) {
+    // Owned by its compound. Releases the shared BVH
+    gcShape(((btScaledBvhTriangleMeshShape*) shape)->getChildShape());
+    delete shape;
+    return;
+  }
+  if (shape->getUserPointer() == nullptr) {
+    // Not cached (voxel chunks own their shape)
+    delete shape;
+    return;
+  }
+  if (shape->isCompound()) {
+    auto entry = compoundShapes.find(*((std::string*) shape->getUserPointer()));
+    entry->second.refs--;
+    if (entry->second.refs > 0) {
+      return;
+    }
+    compoundShapes.erase(entry);
+    btCompoundShape* compound = (btCompoundShape*) shape;
+    for (int i = 0, l = compound->getNumChildShapes(); i < l; i++) {
+      gcShape(compound->getChildShape(i));
+    }
+  } else if (shape->getShapeType() == TRIANGLE_MESH_SHAPE_PROXYTYPE) {
+    auto entry = meshShapes.find(*((std::string*) shape->getUserPointer()));
+    entry->second.refs--;
+    if (entry->second.refs > 0) {
+      return;
+    }
+    btTriangleMesh* mesh = entry->second.mesh;
+    void* bvh = entry->second.bvh;
+    meshShapes.erase(entry);
+    delete shape;
+    delete mesh;
+    if (bvh != nullptr) {
+      btAlignedFree(bvh);
+    }
+    return;
+  } else {
+    auto entry = colliderShapes.find(*((PhysicsSharedShapeKey*) shape->getUserPointer()));
+    entry->second.refs--;
+    if (entry->second.refs > 0) {
+      return;
+    }
+    colliderShapes.erase(entry);
+  }
+  delete shape;
+}
+
 btCollisionObject* Physics::getTempCollider(const GeometryColliderShape shape, const glm::vec3& position, const glm::vec3& scale) {
-  btCollisionShape* collider = getColliderShape(shape, scale);
+  // Borrows from the shape cache so repeated queries don't allocate
+  btCollisionShape* collider = getSharedColliderShape(shape, scale);
   transform.setIdentity();
   transform.setOrigin(btVector3(position.x, position.y, position.z));
   if (ghost.getCollisionShape() != nullptr) {
-    delete ghost.getCollisionShape();
+    gcShape(ghost.getCollisionShape());
   }
   ghost.setCollisionShape(collider);
   ghost.setWorldTransform(transform);
+  btVector3 aabbMin, aabbMax;
+  collider->getAabb(transform, aabbMin, aabbMax);
+  loadChunks(aabbMin, aabbMax);
   return (btCollisionObject*) &ghost;
 }
 
+void Physics::postTickCallback(btDynamicsWorld* world, btScalar timeStep) {
+  ((Physics*) world->getWorldUserInfo())->updateContacts();
+}
+
+void Physics::updateContacts() {
+  // Runs after every substep. Reads the touching pairs out of the manifolds
+  // in the dispatcher, so per body queries don't redo the narrowphase.
+  contacts.clear();
+  std::map<std::pair<GLuint, GLuint>, GLbyte> pairs;
+  for (int i = 0, l = dispatcher->getNumManifolds(); i < l; i++) {
+    const btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+    PhysicsContact contact;
+    contact.bodyA = manifold->getBody0();
+    contact.bodyB = manifold->getBody1();
+    if (
+      !getBodyData((btCollisionObject*) contact.bodyA, contact.idA, contact.flagsA)
+      || !getBodyData((btCollisionObject*) contact.bodyB, contact.idB, contact.flagsB)
+    ) {
+      continue;
+    }
+    bool isTouching = false;
+    contact.normal = glm::vec3(0.0, 0.0, 0.0);
+    contact.distance = 0.0;
+    for (int j = 0, c = manifold->getNumContacts(); j < c; j++) {
+      const btManifoldPoint& point = manifold->getContactPoint(j);
+      const GLfloat distance = point.getDistance();
+      if (distance > 0.0) {
+        continue;
+      }
+      contact.distance = isTouching ? glm::min(contact.distance, distance) : distance;
+      contact.normal += glm::vec3(
+        point.m_normalWorldOnB.x(),
+        point.m_normalWorldOnB.y(),
+        point.m_normalWorldOnB.z()
+      ) * -distance;
+      isTouching = true;
+    }
+    if (!isTouching) {
+      continue;
+    }
+    contacts.push_back(contact);
+    pairs[std::minmax(contact.idA, contact.idB)] |= contact.flagsA | contact.flagsB;
+  }
+  for (const auto& [pair, flags] : pairs) {
+    if (!contactPairs.contains(pair)) {
+      contactEvents.push_back({ PHYSICS_CONTACT_BEGIN, pair.first, pair.second, flags });
+      contactBegins.insert(pair);
+    }
+  }
+  for (const auto& [pair, flags] : contactPairs) {
+    if (!pairs.contains(pair)) {
+      contactEvents.push_back({ PHYSICS_CONTACT_END, pair.first, pair.second, flags });
+    }
+  }
+  contactPairs.swap(pairs);
+}
+
+const std::vector<PhysicsContactEvent>& Physics::getContactEvents() {
+  return contactEvents;
+}
+
+void Physics::resetContacts() {
+  contactBegins.clear();
+  contactEvents.clear();
+  contactPairs.clear();
+}
+
 std::vector<GLuint> Physics::getContactIds(btCollisionObject* target, const GLubyte mask) {
+  // Static and kinematic bodies have no manifolds against other static
+  // ones and the query colliders are not in the world. Those still run a test.
+  if (target->isStaticOrKinematicObject()) {
+    return testContactIds(target, mask);
+  }
+  struct Contact {
+    GLuint id;
+    GLfloat distance;
+  };
+  std::vector<Contact> found;
+  for (const auto& contact : contacts) {
+    if (contact.bodyA == target && (mask == 0 || (contact.flagsB & mask))) {
+      found.push_back({ contact.idB, contact.distance });
+    } else if (contact.bodyB == target && (mask == 0 || (contact.flagsA & mask))) {
+      found.push_back({ contact.idA, contact.distance });
+    }
+  }
+  std::sort(found.begin(), found.end(), [](auto& a, auto& b) {
+    return a.distance > b.distance;
+  });
+  std::vector<GLuint> contactIds;
+  for (const auto& contact : found) {
+    if (std::find(contactIds.begin(), contactIds.end(), contact.id) == contactIds.end()) {
+      contactIds.push_back(contact.id);
+    }
+  }
+  return contactIds;
+}
+
+glm::vec3 Physics::getAccumulatedContacts(btCollisionObject* target, const GLubyte mask) {
+  if (target->isStaticOrKinematicObject()) {
+    return testAccumulatedContacts(target, mask);
+  }
+  glm::vec3 accumulated(0.0, 0.0, 0.0);
+  for (const auto& contact : contacts) {
+    if (contact.bodyA == target && (mask == 0 || (contact.flagsB & mask))) {
+      accumulated += contact.normal;
+    } else if (contact.bodyB == target && (mask == 0 || (contact.flagsA & mask))) {
+      accumulated -= contact.normal;
+    }
+  }
+  return accumulated;
+}
+
+std::vector<GLuint> Physics::testContactIds(btCollisionObject* target, const GLubyte mask) {
   struct ResultCallback : public btCollisionWorld::ContactResultCallback {
     struct Contact {
       GLuint id;
@@ -264,7 +899,7 @@ std::vector<GLuint> Physics::getContactIds(btCollisionObject* target, const GLub
   return contactIds;
 }
 
-glm::vec3 Physics::getAccumulatedContacts(btCollisionObject* target, const GLubyte mask) {
+glm::vec3 Physics::testAccumulatedContacts(btCollisionObject* target, const GLubyte mask) {
   struct ResultCallback : public btCollisionWorld::ContactResultCallback {
     glm::vec3 contacts;
     btCollisionObject* target;
@@ -301,6 +936,150 @@ glm::vec3 Physics::getAccumulatedContacts(btCollisionObject* target, const GLuby
   return cb.contacts;
 }
 
+bool Physics::raycast(const glm::vec3& origin, const glm::vec3& direction, const GLfloat distance, const GLubyte mask, PhysicsHit& hit) {
+  struct ResultCallback : public btCollisionWorld::ClosestRayResultCallback {
+    const GLubyte mask;
+    ResultCallback(const btVector3& from, const btVector3& to, const GLubyte mask) : ClosestRayResultCallback(from, to), mask(mask) {}
+    virtual bool needsCollision(btBroadphaseProxy* proxy) const {
+      return ClosestRayResultCallback::needsCollision(proxy) && isQueryable(proxy, mask);
+    }
+  };
+  const GLfloat length = glm::length(direction);
+  if (length == 0.0 || distance <= 0.0) {
+    return false;
+  }
+  const glm::vec3 target = origin + direction * (distance / length);
+  ResultCallback cb(btVector3(origin.x, origin.y, origin.z), btVector3(target.x, target.y, target.z), mask);
+  loadChunksAlongRay(cb.m_rayFromWorld, cb.m_rayToWorld);
+  dynamicsWorld->rayTest(cb.m_rayFromWorld, cb.m_rayToWorld, cb);
+  if (!cb.hasHit()) {
+    return false;
+  }
+  GLbyte flags;
+  getBodyData((btCollisionObject*) cb.m_collisionObject, hit.id, flags);
+  hit.point = glm::vec3(cb.m_hitPointWorld.x(), cb.m_hitPointWorld.y(), cb.m_hitPointWorld.z());
+  hit.normal = glm::vec3(cb.m_hitNormalWorld.x(), cb.m_hitNormalWorld.y(), cb.m_hitNormalWorld.z());
+  hit.fraction = cb.m_closestHitFraction;
+  return true;
+}
+
+bool Physics::sweep(const GeometryColliderShape shape, const glm::vec3& scale, const glm::vec3& from, const glm::vec3& to, const GLubyte mask, PhysicsHit& hit) {
+  struct ResultCallback : public btCollisionWorld::ClosestConvexResultCallback {
+    const GLubyte mask;
+    ResultCallback(const btVector3& from, const btVector3& to, const GLubyte mask) : ClosestConvexResultCallback(from, to), mask(mask) {}
+    virtual bool needsCollision(btBroadphaseProxy* proxy) const {
+      return ClosestConvexResultCallback::needsCollision(proxy) && isQueryable(proxy, mask);
+    }
+  };
+  if (from == to) {
+    return false;
+  }
+  btConvexShape* collider = (btConvexShape*) getSharedColliderShape(shape, scale);
+  btTransform start, end;
+  start.setIdentity();
+  start.setOrigin(btVector3(from.x, from.y, from.z));
+  end.setIdentity();
+  end.setOrigin(btVector3(to.x, to.y, to.z));
+  ResultCallback cb(start.getOrigin(), end.getOrigin(), mask);
+  btVector3 aabbMin, aabbMax, endMin, endMax;
+  collider->getAabb(start, aabbMin, aabbMax);
+  collider->getAabb(end, endMin, endMax);
+  aabbMin.setMin(endMin);
+  aabbMax.setMax(endMax);
+  loadChunks(aabbMin, aabbMax);
+  dynamicsWorld->convexSweepTest(collider, start, end, cb);
+  gcShape(collider);
+  if (!cb.hasHit()) {
+    return false;
+  }
+  GLbyte flags;
+  getBodyData((btCollisionObject*) cb.m_hitCollisionObject, hit.id, flags);
+  hit.point = glm::vec3(cb.m_hitPointWorld.x(), cb.m_hitPointWorld.y(), cb.m_hitPointWorld.z());
+  hit.normal = glm::vec3(cb.m_hitNormalWorld.x(), cb.m_hitNormalWorld.y(), cb.m_hitNormalWorld.z());
+  hit.fraction = cb.m_closestHitFraction;
+  return true;
+}
+
 void Physics::setGravity(const glm::vec3& gravity) {
   dynamicsWorld->setGravity(btVector3(gravity.x, gravity.y, gravity.z));
+  for (const auto& character : characters) {
+    character->getController()->setGravity(dynamicsWorld->getGravity());
+  }
+}
+
+void Physics::setTimestep(const GLfloat value, const GLint maxSubSteps) {
+  timestep = value;
+  this->maxSubSteps = maxSubSteps;
+}
+
+bool Physics::setThreads(const GLint count) {
+  const GLint threads = glm::max(count, 1);
+  if (threads > 1) {
+    // The default scheduler is process wide and only exists
+    // when bullet was built with BT_THREADSAFE.
+    static btITaskScheduler* scheduler = btCreateDefaultTaskScheduler();
+    if (scheduler == nullptr) {
+      return false;
+    }
+    scheduler->setNumThreads(glm::min(threads, scheduler->getMaxNumThreads()));
+    btSetTaskScheduler(scheduler);
+  }
+  if (threads == this->threads) {
+    return true;
+  }
+  this->threads = threads;
+  createWorld();
+  return true;
+}
+
+void Physics::createWorld() {
+  btDiscreteDynamicsWorld* previous = dynamicsWorld;
+  btCollisionDispatcher* previousDispatcher = dispatcher;
+  btConstraintSolver* previousSolver = solver;
+  btConstraintSolverPoolMt* previousSolverPool = solverPool;
+  btVector3 gravity(0, -10, 0);
+  std::vector<btRigidBody*> bodies;
+  if (previous != nullptr) {
+    gravity = previous->getGravity();
+    for (const auto& character : characters) {
+      previous->removeAction(character->getController());
+      previous->removeCollisionObject(character->getGhost());
+    }
+    btCollisionObjectArray& objects = previous->getCollisionObjectArray();
+    for (int i = objects.size() - 1; i >= 0; i--) {
+      btRigidBody* body = btRigidBody::upcast(objects[i]);
+      if (body) {
+        previous->removeRigidBody(body);
+        bodies.push_back(body);
+      }
+    }
+  }
+
+  if (threads > 1) {
+    dispatcher = new btCollisionDispatcherMt(collisionConfiguration);
+    solver = new btSequentialImpulseConstraintSolverMt();
+    solverPool = new btConstraintSolverPoolMt(threads);
+    dynamicsWorld = new btDiscreteDynamicsWorldMt(dispatcher, broadphase, solverPool, solver, collisionConfiguration);
+  } else {
+    dispatcher = new btCollisionDispatcher(collisionConfiguration);
+    solver = new btSequentialImpulseConstraintSolver();
+    solverPool = nullptr;
+    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher, broadphase, solver, collisionConfiguration);
+  }
+  dynamicsWorld->setGravity(gravity);
+  dynamicsWorld->setInternalTickCallback(preTickCallback, (void*) this, true);
+  dynamicsWorld->setInternalTickCallback(postTickCallback, (void*) this, false);
+  for (auto i = bodies.rbegin(); i != bodies.rend(); i++) {
+    dynamicsWorld->addRigidBody(*i);
+  }
+  std::vector<Character*> previousCharacters;
+  previousCharacters.swap(characters);
+  for (const auto& character : previousCharacters) {
+    addCharacter(character);
+  }
+
+  delete previous;
+  delete previousSolverPool;
+  delete previousSolver;
+  delete previousDispatcher;
 }
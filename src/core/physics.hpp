@@ -4,33 +4,145 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <btBulletDynamicsCommon.h>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
 #include <BulletCollision/CollisionDispatch/btGhostObject.h>
+#include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
 #include "../gl/geometry.hpp"
 #include "../gl/mesh.hpp"
 #include "../gl/voxels/chunk.hpp"
+#include "../gl/voxels/collider.hpp"
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+
+class Character;
+class PhysicsMotionState;
+
+struct PhysicsSharedShape {
+  btCollisionShape* shape;
+  GLuint refs;
+};
+
+struct PhysicsMeshShape {
+  btBvhTriangleMeshShape* shape;
+  btTriangleMesh* mesh;
+  void* bvh;
+  GLuint refs;
+};
+
+struct PhysicsHit {
+  GLuint id;
+  glm::vec3 point;
+  glm::vec3 normal;
+  GLfloat fraction;
+};
+
+enum PhysicsContactEventType {
+  PHYSICS_CONTACT_BEGIN,
+  PHYSICS_CONTACT_PERSIST,
+  PHYSICS_CONTACT_END,
+};
+
+struct PhysicsContactEvent {
+  PhysicsContactEventType type;
+  GLuint idA;
+  GLuint idB;
+  GLbyte flags;
+};
+
+struct PhysicsContact {
+  const btCollisionObject* bodyA;
+  const btCollisionObject* bodyB;
+  GLuint idA;
+  GLuint idB;
+  GLbyte flagsA;
+  GLbyte flagsB;
+  glm::vec3 normal;
+  GLfloat distance;
+};
+
+typedef std::tuple<GLint, GLint, GLint> PhysicsChunkKey;
+
+typedef std::tuple<GeometryColliderShape, GLuint, GLuint, GLuint> PhysicsSharedShapeKey;
 
 class Physics {
   public:
     Physics();
+    ~Physics();
     void step(GLfloat delta);
     void addBody(Mesh* mesh, const GLfloat mass, const bool isAlwaysActive, const bool isKinematic);
     void addBody(VoxelChunk* chunk);
-    btRigidBody* addBody(const std::vector<GeometryCollider>& colliders, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, const GLfloat mass = 0.0, const bool isAlwaysActive = false, const bool isKinematic = false);
+    btRigidBody* addBody(const std::vector<GeometryCollider>& colliders, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale, const GLfloat mass = 0.0, const bool isAlwaysActive = false, const bool isKinematic = false, Geometry* geometry = nullptr);
     void removeBody(btRigidBody* body);
+    void removeBody(VoxelChunk* chunk);
+    void addCharacter(Character* character);
+    void removeCharacter(Character* character);
+    btDiscreteDynamicsWorld* getWorld();
+    void queueCollidersUpdate(VoxelChunk* chunk);
     void setBodyPosition(btRigidBody* body, const glm::vec3& position);
     void setBodyRotation(btRigidBody* body, const glm::quat& rotation);
     btCollisionObject* getTempCollider(const GeometryColliderShape shape, const glm::vec3& position, const glm::vec3& scale);
     std::vector<GLuint> getContactIds(btCollisionObject* target, const GLubyte mask);
     glm::vec3 getAccumulatedContacts(btCollisionObject* target, const GLubyte mask);
+    const std::vector<PhysicsContactEvent>& getContactEvents();
+    void resetContacts();
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, const GLfloat distance, const GLubyte mask, PhysicsHit& hit);
+    bool sweep(const GeometryColliderShape shape, const glm::vec3& scale, const glm::vec3& from, const glm::vec3& to, const GLubyte mask, PhysicsHit& hit);
     void setGravity(const glm::vec3& gravity);
+    void setTimestep(const GLfloat value, const GLint maxSubSteps);
+    bool setThreads(const GLint count);
   private:
+    btScalar accumulator;
+    std::vector<Character*> characters;
+    std::vector<PhysicsMotionState*> active;
+    std::map<PhysicsSharedShapeKey, PhysicsSharedShape> colliderShapes;
+    std::set<std::pair<GLuint, GLuint>> contactBegins;
+    std::vector<PhysicsContactEvent> contactEvents;
+    std::map<std::pair<GLuint, GLuint>, GLbyte> contactPairs;
+    std::vector<PhysicsContact> contacts;
+    std::map<std::string, PhysicsSharedShape> compoundShapes;
+    std::vector<VoxelChunk*> dirtyChunks;
+    std::map<std::string, PhysicsMeshShape> meshShapes;
+    GLuint frame;
+    std::map<PhysicsChunkKey, std::vector<VoxelChunk*>> lazyChunks;
+    std::map<VoxelChunk*, GLuint> loadedChunks;
+    GLint maxSubSteps;
+    bool needsActiveReset;
+    GLint threads;
+    btScalar timestep;
     btDefaultCollisionConfiguration* collisionConfiguration;
     btCollisionDispatcher* dispatcher;
     btBroadphaseInterface* broadphase;
     btConstraintSolver* solver;
+    btConstraintSolverPoolMt* solverPool;
     btDiscreteDynamicsWorld* dynamicsWorld;
     btGhostObject ghost;
+    btGhostPairCallback ghostPairCallback;
     btTransform transform;
+    void createWorld();
+    void loadChunk(VoxelChunk* chunk);
+    void loadChunks(const btVector3& aabbMin, const btVector3& aabbMax);
+    void loadChunksAlongRay(const btVector3& from, const btVector3& to);
+    void updateChunks();
+    bool isSupporting(btRigidBody* chunk);
+    void updateContacts();
+    std::vector<GLuint> testContactIds(btCollisionObject* target, const GLubyte mask);
+    glm::vec3 testAccumulatedContacts(btCollisionObject* target, const GLubyte mask);
+    btCollisionShape* getCompoundShape(const std::vector<GeometryCollider>& colliders, const glm::vec3& scale, Geometry* geometry);
+    btBvhTriangleMeshShape* getSharedMeshShape(Geometry* geometry, const std::string& key);
+    btCollisionShape* getSharedColliderShape(const GeometryColliderShape shape, const glm::vec3& scale);
+    void gcShape(btCollisionShape* shape);
+    void refreshContacts(btRigidBody* body);
+    static PhysicsChunkKey getChunkKey(VoxelChunk* chunk);
+    static std::string getMeshKey(Geometry* geometry);
+    static GLuint getKeyBits(const GLfloat value);
     static bool getBodyData(btCollisionObject* target, GLuint& id, GLbyte& flags);
+    static bool isQueryable(btBroadphaseProxy* proxy, const GLubyte mask);
+    static void preTickCallback(btDynamicsWorld* world, btScalar timeStep);
+    static void postTickCallback(btDynamicsWorld* world, btScalar timeStep);
     static btCollisionShape* getColliderShape(const GeometryColliderShape shape, const glm::vec3& scale);
 };
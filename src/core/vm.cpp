@@ -9,17 +9,21 @@ VM::VM(HTTP* http, WindowContext* window):
   camera(),
   clearColor(glm::vec4(0, 0, 0, 1)),
   cubemapbuffer(),
+  drawbuffer(),
+  renderQueue(&camera, &drawbuffer),
   http(http),
   irradiance(),
   physics(),
   raycaster(),
+  scene(),
   source(""),
   lastTick(0),
   startTime(0),
   window(window),
   box(2, 2, 2),
   plane(2, 2),
-  sphere(1)
+  sphere(1),
+  workers()
 {
   init();
 }
@@ -35,6 +39,10 @@ void VM::init() {
 
   lua_newtable(L);
 
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, character_new, 1);
+  lua_setfield(L, -2, "Character");
+
   lua_pushlightuserdata(L, this);
   lua_pushcclosure(L, environment_new, 1);
   lua_setfield(L, -2, "Environment");
@@ -122,6 +130,8 @@ void VM::init() {
 
   lua_pushcfunction(L, info);
   lua_setfield(L, -2, "info");
+  lua_pushcfunction(L, getStateChanges);
+  lua_setfield(L, -2, "getStateChanges");
   lua_pushlightuserdata(L, window);
   lua_pushcclosure(L, navigate, 1);
   lua_setfield(L, -2, "navigate");
@@ -129,6 +139,9 @@ void VM::init() {
   lua_pushcclosure(L, setClearColor, 1);
   lua_setfield(L, -2, "setClearColor");
   lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, setRenderQueue, 1);
+  lua_setfield(L, -2, "setRenderQueue");
+  lua_pushlightuserdata(L, this);
   lua_pushcclosure(L, showTooltip, 1);
   lua_setfield(L, -2, "showTooltip");
 
@@ -162,8 +175,26 @@ void VM::init() {
   lua_pushcclosure(L, physics_getContactIds, 1);
   lua_setfield(L, -2, "getContactIds");
   lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, physics_getContactEvents, 1);
+  lua_setfield(L, -2, "getContactEvents");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, physics_raycast, 1);
+  lua_setfield(L, -2, "raycast");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, physics_raycastBatch, 1);
+  lua_setfield(L, -2, "raycastBatch");
+  lua_pushlightuserdata(L, this);
   lua_pushcclosure(L, physics_setGravity, 1);
   lua_setfield(L, -2, "setGravity");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, physics_setThreads, 1);
+  lua_setfield(L, -2, "setThreads");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, physics_setTimestep, 1);
+  lua_setfield(L, -2, "setTimestep");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, physics_sweep, 1);
+  lua_setfield(L, -2, "sweep");
   lua_setfield(L, -2, "physics");
 
   lua_newtable(L);
@@ -174,6 +205,9 @@ void VM::init() {
   lua_pushcclosure(L, raycaster_intersect, 1);
   lua_setfield(L, -2, "intersect");
   lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, raycaster_intersectBatch, 1);
+  lua_setfield(L, -2, "intersectBatch");
+  lua_pushlightuserdata(L, this);
   lua_pushcclosure(L, raycaster_getRay, 1);
   lua_setfield(L, -2, "getRay");
   lua_pushlightuserdata(L, this);
@@ -181,6 +215,24 @@ void VM::init() {
   lua_setfield(L, -2, "getResult");
   lua_setfield(L, -2, "raycaster");
 
+  lua_newtable(L);
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, scene_add, 1);
+  lua_setfield(L, -2, "add");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, scene_remove, 1);
+  lua_setfield(L, -2, "remove");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, scene_intersect, 1);
+  lua_setfield(L, -2, "intersect");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, scene_getInFrustum, 1);
+  lua_setfield(L, -2, "getInFrustum");
+  lua_pushlightuserdata(L, this);
+  lua_pushcclosure(L, scene_getInRadius, 1);
+  lua_setfield(L, -2, "getInRadius");
+  lua_setfield(L, -2, "scene");
+
   lua_newtable(L);
   lua_pushlightuserdata(L, window);
   lua_pushcclosure(L, mouse_lock, 1);
@@ -236,9 +288,13 @@ void VM::init() {
 void VM::reset() {
   lua_close(L);
   init();
+  renderQueue.setEnabled(false);
   camera.reset();
   clearColor = glm::vec4(0, 0, 0, 1);
   physics.setGravity(glm::vec3(0, -10, 0));
+  physics.setTimestep(1.0 / 60.0, 8);
+  physics.setThreads(1);
+  physics.resetContacts();
   errors.clear();
   messages.clear();
   tooltips.clear();
@@ -249,7 +305,7 @@ void VM::reset() {
 void VM::resetGL() {
   // glViewport(0, 0, window->resolution.x, window->resolution.y);
   // camera.setAspect(window->resolution.x / window->resolution.y);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
   // for (GLint i = 0; i < 16; i++) {
   //   glActiveTexture(GL_TEXTURE0 + i);
   //   glBindTexture(GL_TEXTURE_2D, 0);
@@ -296,7 +352,10 @@ void VM::load(const std::string& src) {
 }
 
 void VM::loop() {
-  glViewport(0, 0, window->resolution.x, window->resolution.y);
+  GLState::nextFrame();
+  Image::nextFrame();
+  Environment::nextFrame();
+  GLState::setViewport(0, 0, window->resolution.x, window->resolution.y);
   glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   camera.setAspect(window->resolution.x / window->resolution.y);
@@ -309,7 +368,19 @@ void VM::loop() {
   const GLfloat delta = glm::min((GLfloat) time - lastTick, (GLfloat) 0.2);
   lastTick = time;
   physics.step(delta);
+  camera.bindBuffer();
+  drawbuffer.nextFrame();
 
+  // Compile errors only show up once the driver is done with the program
+  std::erase_if(pendingShaders, [this](Shader* shader) {
+    if (!shader->isReady()) {
+      return false;
+    }
+    if (!shader->getError().empty()) {
+      logError(shader->getError());
+    }
+    return true;
+  });
   for (const auto& shader : shaders) {
     shader->setUniformVec2("resolution", window->resolution);
     shader->setUniformFloat("time", time);
@@ -370,6 +441,7 @@ void VM::loop() {
     lua_pop(L, 1);
     isReady = false;
   }
+  renderQueue.flush();
 
   lua_gc(L, LUA_GCCOLLECT);
   resetGL();
@@ -397,6 +469,31 @@ void VM::logError(std::string msg) {
   }
 }
 
+int VM::pushPhysicsHit(lua_State* L, const PhysicsHit& hit) {
+  lua_pushinteger(L, hit.id);
+  lua_pushnumber(L, hit.point.x);
+  lua_pushnumber(L, hit.point.y);
+  lua_pushnumber(L, hit.point.z);
+  lua_pushnumber(L, hit.normal.x);
+  lua_pushnumber(L, hit.normal.y);
+  lua_pushnumber(L, hit.normal.z);
+  lua_pushnumber(L, hit.fraction);
+  return 8;
+}
+
+GLint VM::getShaderUniform(lua_State* L, Shader* shader, GLint index) {
+  if (lua_type(L, index) == LUA_TNUMBER) {
+    return luaL_checkinteger(L, index);
+  }
+  return shader->getUniform(luaL_checkstring(L, index));
+}
+
+const glm::vec3* VM::getSH(lua_State* L, GLint index) {
+  // Null until the environment is decoded
+  Environment* environment = *((Environment**) luaL_checkudata(L, index, "Environment"));
+  return environment->getSH();
+}
+
 Texture* VM::getTexture(lua_State* L, GLint index) {
   Environment** environment = (Environment**) luaL_testudata(L, index, "Environment");
   if (environment != nullptr) {
@@ -458,6 +555,13 @@ int VM::info(lua_State* L) {
   return 3;
 }
 
+int VM::getStateChanges(lua_State* L) {
+  const GLStateCounters& counters = GLState::getCounters();
+  lua_pushinteger(L, counters.issued);
+  lua_pushinteger(L, counters.filtered);
+  return 2;
+}
+
 int VM::navigate(lua_State* L) {
   WindowContext* ctx = (WindowContext*) lua_topointer(L, lua_upvalueindex(1));
   ctx->setURL(luaL_checkstring(L, 1));
@@ -473,6 +577,12 @@ int VM::setClearColor(lua_State* L) {
   return 0;
 }
 
+int VM::setRenderQueue(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.setEnabled(lua_toboolean(L, 1));
+  return 0;
+}
+
 int VM::showTooltip(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   const std::string message = luaL_checkstring(L, 1);
@@ -583,6 +693,7 @@ int VM::srgb(lua_State* L) {
 
 int VM::camera_lookAt(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   const GLfloat x = luaL_checknumber(L, 1);
   const GLfloat y = luaL_checknumber(L, 2);
   const GLfloat z = luaL_checknumber(L, 3);
@@ -598,6 +709,7 @@ int VM::camera_getFov(lua_State* L) {
 
 int VM::camera_setFov(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   const GLfloat value = luaL_checknumber(L, 1);
   vm->camera.setFov(value);
   return 0;
@@ -614,6 +726,7 @@ int VM::camera_getPosition(lua_State* L) {
 
 int VM::camera_setPosition(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   const GLfloat x = luaL_checknumber(L, 1);
   const GLfloat y = luaL_checknumber(L, 2);
   const GLfloat z = luaL_checknumber(L, 3);
@@ -672,6 +785,10 @@ int VM::mouse_unlock(lua_State* L) {
 int VM::physics_getContacts(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   const GeometryColliderShape shape = (GeometryColliderShape) luaL_checkoption(L, 1, nullptr, GeometryColliderShapeNames);
+  if (shape == GEOMETRY_COLLIDER_MESH) {
+    lua_pushliteral(L, "Physics.getContacts - mesh colliders can't be used in queries");
+    lua_error(L);
+  }
   const GLfloat x = luaL_checknumber(L, 2);
   const GLfloat y = luaL_checknumber(L, 3);
   const GLfloat z = luaL_checknumber(L, 4);
@@ -690,6 +807,10 @@ int VM::physics_getContacts(lua_State* L) {
 int VM::physics_getContactIds(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   const GeometryColliderShape shape = (GeometryColliderShape) luaL_checkoption(L, 1, nullptr, GeometryColliderShapeNames);
+  if (shape == GEOMETRY_COLLIDER_MESH) {
+    lua_pushliteral(L, "Physics.getContactIds - mesh colliders can't be used in queries");
+    lua_error(L);
+  }
   const GLfloat x = luaL_checknumber(L, 2);
   const GLfloat y = luaL_checknumber(L, 3);
   const GLfloat z = luaL_checknumber(L, 4);
@@ -710,6 +831,74 @@ int VM::physics_getContactIds(lua_State* L) {
   return count;
 }
 
+int VM::physics_getContactEvents(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GLubyte mask = luaL_optinteger(L, 1, 0);
+  const std::vector<PhysicsContactEvent>& events = vm->physics.getContactEvents();
+  lua_createtable(L, events.size() * 3, 0);
+  int i = 1;
+  for (const auto& event : events) {
+    if (mask > 0 && !(event.flags & mask)) {
+      continue;
+    }
+    lua_pushinteger(L, event.type);
+    lua_rawseti(L, -2, i++);
+    lua_pushinteger(L, event.idA);
+    lua_rawseti(L, -2, i++);
+    lua_pushinteger(L, event.idB);
+    lua_rawseti(L, -2, i++);
+  }
+  return 1;
+}
+
+int VM::physics_raycast(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GLfloat x = luaL_checknumber(L, 1);
+  const GLfloat y = luaL_checknumber(L, 2);
+  const GLfloat z = luaL_checknumber(L, 3);
+  const GLfloat dx = luaL_checknumber(L, 4);
+  const GLfloat dy = luaL_checknumber(L, 5);
+  const GLfloat dz = luaL_checknumber(L, 6);
+  const GLfloat distance = luaL_optnumber(L, 7, 1000.0);
+  const GLubyte mask = luaL_optinteger(L, 8, 0);
+  PhysicsHit hit;
+  if (!vm->physics.raycast(glm::vec3(x, y, z), glm::vec3(dx, dy, dz), distance, mask, hit)) {
+    return 0;
+  }
+  return pushPhysicsHit(L, hit);
+}
+
+int VM::physics_raycastBatch(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const GLfloat distance = luaL_optnumber(L, 2, 1000.0);
+  const GLubyte mask = luaL_optinteger(L, 3, 0);
+  const int count = luaL_len(L, 1);
+  if (count % 6 != 0) {
+    lua_pushliteral(L, "Physics.raycastBatch - rays must be a flat list of x, y, z, dx, dy, dz");
+    lua_error(L);
+  }
+  const int rays = count / 6;
+  lua_createtable(L, rays * 8, 0);
+  for (int i = 0; i < rays; i++) {
+    GLfloat ray[6];
+    for (int j = 0; j < 6; j++) {
+      lua_rawgeti(L, 1, i * 6 + j + 1);
+      ray[j] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+    PhysicsHit hit;
+    if (!vm->physics.raycast(glm::vec3(ray[0], ray[1], ray[2]), glm::vec3(ray[3], ray[4], ray[5]), distance, mask, hit)) {
+      hit = { 0, glm::vec3(0.0), glm::vec3(0.0), 1.0 };
+    }
+    pushPhysicsHit(L, hit);
+    for (int j = 8; j > 0; j--) {
+      lua_rawseti(L, -(j + 1), i * 8 + j);
+    }
+  }
+  return 1;
+}
+
 int VM::physics_setGravity(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   const GLfloat x = luaL_checknumber(L, 1);
@@ -719,6 +908,49 @@ int VM::physics_setGravity(lua_State* L) {
   return 0;
 }
 
+int VM::physics_setThreads(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GLint count = luaL_checkinteger(L, 1);
+  lua_pushboolean(L, vm->physics.setThreads(count));
+  return 1;
+}
+
+int VM::physics_setTimestep(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GLfloat timestep = luaL_checknumber(L, 1);
+  const GLint maxSubSteps = glm::max((GLint) luaL_optinteger(L, 2, 8), (GLint) 1);
+  if (timestep <= 0.0) {
+    lua_pushliteral(L, "Physics::setTimestep - timestep must be greater than 0");
+    lua_error(L);
+  }
+  vm->physics.setTimestep(timestep, maxSubSteps);
+  return 0;
+}
+
+int VM::physics_sweep(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GeometryColliderShape shape = (GeometryColliderShape) luaL_checkoption(L, 1, nullptr, GeometryColliderShapeNames);
+  if (shape == GEOMETRY_COLLIDER_MESH) {
+    lua_pushliteral(L, "Physics.sweep - mesh colliders can't be used in queries");
+    lua_error(L);
+  }
+  const GLfloat x = luaL_checknumber(L, 2);
+  const GLfloat y = luaL_checknumber(L, 3);
+  const GLfloat z = luaL_checknumber(L, 4);
+  const GLfloat tx = luaL_checknumber(L, 5);
+  const GLfloat ty = luaL_checknumber(L, 6);
+  const GLfloat tz = luaL_checknumber(L, 7);
+  const GLfloat sx = luaL_checknumber(L, 8);
+  const GLfloat sy = luaL_checknumber(L, 9);
+  const GLfloat sz = luaL_checknumber(L, 10);
+  const GLubyte mask = luaL_optinteger(L, 11, 0);
+  PhysicsHit hit;
+  if (!vm->physics.sweep(shape, glm::vec3(sx, sy, sz), glm::vec3(x, y, z), glm::vec3(tx, ty, tz), mask, hit)) {
+    return 0;
+  }
+  return pushPhysicsHit(L, hit);
+}
+
 int VM::raycaster_setFromCamera(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   const GLfloat x = luaL_checknumber(L, 1);
@@ -749,6 +981,68 @@ int VM::raycaster_intersect(lua_State* L) {
   return 1;
 }
 
+int VM::raycaster_intersectBatch(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const int count = luaL_len(L, 1);
+  if (count % 6 != 0) {
+    lua_pushliteral(L, "Raycaster.intersectBatch - rays must be a flat list of x, y, z, dx, dy, dz");
+    lua_error(L);
+  }
+  std::vector<RaycasterRay> rays(count / 6);
+  for (size_t i = 0; i < rays.size(); i++) {
+    GLfloat ray[6];
+    for (int j = 0; j < 6; j++) {
+      lua_rawgeti(L, 1, i * 6 + j + 1);
+      ray[j] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+    // Zero length directions are left as they are and always miss
+    const glm::vec3 direction(ray[3], ray[4], ray[5]);
+    const GLfloat length = glm::length(direction);
+    rays[i] = { glm::vec3(ray[0], ray[1], ray[2]), length > 0.0 ? direction / length : glm::vec3(0.0) };
+  }
+  std::vector<RaycasterTarget> targets;
+  const int top = lua_gettop(L);
+  for (int i = 2; i <= top; i++) {
+    Mesh** mesh = (Mesh**) luaL_testudata(L, i, "Mesh");
+    if (mesh != nullptr) {
+      // getBounds applies pending geometry updates, so isValid is current after it
+      Geometry* geometry = (*mesh)->getGeometry();
+      const GeometryBounds bounds = (*mesh)->getBounds();
+      if (geometry->isValid) {
+        targets.push_back({ (*mesh)->getId(), bounds, geometry->getBVH(), (*mesh)->getTransform() });
+      }
+    } else {
+      Voxels* voxels = *((Voxels**) luaL_checkudata(L, i, "Voxels"));
+      for (const auto& [k,chunk] : voxels->getChunks()) {
+        const GeometryBounds bounds = chunk->getBounds();
+        if (chunk->isValid) {
+          targets.push_back({ voxels->getId(), bounds, chunk->getBVH(), chunk->getTransform() });
+        }
+      }
+    }
+  }
+  std::vector<RaycasterHit> hits;
+  Raycaster::intersectBatch(rays, targets, hits, &vm->workers);
+  lua_createtable(L, hits.size() * 8, 0);
+  for (size_t i = 0; i < hits.size(); i++) {
+    const RaycasterHit& hit = hits[i];
+    const GLfloat values[] = {
+      hit.position.x, hit.position.y, hit.position.z,
+      hit.normal.x, hit.normal.y, hit.normal.z,
+      hit.id != 0 ? hit.distance : (GLfloat) 0.0,
+    };
+    lua_pushinteger(L, hit.id);
+    lua_rawseti(L, -2, i * 8 + 1);
+    for (int j = 0; j < 7; j++) {
+      lua_pushnumber(L, values[j]);
+      lua_rawseti(L, -2, i * 8 + j + 2);
+    }
+  }
+  return 1;
+}
+
 int VM::raycaster_getResult(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   lua_pushnumber(L, vm->raycaster.result.position.x);
@@ -771,9 +1065,150 @@ int VM::raycaster_getRay(lua_State* L) {
   return 6;
 }
 
+int VM::scene_add(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const int count = lua_gettop(L);
+  for (int i = 1; i <= count; i++) {
+    Mesh* mesh = *((Mesh**) luaL_checkudata(L, i, "Mesh"));
+    vm->scene.add(mesh);
+  }
+  return 0;
+}
+
+int VM::scene_remove(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const int count = lua_gettop(L);
+  for (int i = 1; i <= count; i++) {
+    Mesh* mesh = *((Mesh**) luaL_checkudata(L, i, "Mesh"));
+    vm->scene.remove(mesh);
+  }
+  return 0;
+}
+
+int VM::scene_intersect(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->raycaster.init();
+  vm->scene.intersect(&vm->raycaster);
+  if (vm->raycaster.result.id == 0) {
+    return 0;
+  }
+  lua_pushinteger(L, vm->raycaster.result.id);
+  return 1;
+}
+
+int VM::scene_getInFrustum(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  std::vector<Mesh*> meshes;
+  vm->scene.getInFrustum(&vm->camera, meshes);
+  lua_createtable(L, meshes.size(), 0);
+  for (size_t i = 0; i < meshes.size(); i++) {
+    lua_pushinteger(L, meshes[i]->getId());
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+int VM::scene_getInRadius(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GLfloat x = luaL_checknumber(L, 1);
+  const GLfloat y = luaL_checknumber(L, 2);
+  const GLfloat z = luaL_checknumber(L, 3);
+  const GLfloat radius = luaL_checknumber(L, 4);
+  std::vector<Mesh*> meshes;
+  vm->scene.getInRadius(glm::vec3(x, y, z), radius, meshes);
+  lua_createtable(L, meshes.size(), 0);
+  for (size_t i = 0; i < meshes.size(); i++) {
+    lua_pushinteger(L, meshes[i]->getId());
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+int VM::character_getPosition(lua_State* L) {
+  Character* character = *((Character**) luaL_checkudata(L, 1, "Character"));
+  const glm::vec3 position = character->getPosition();
+  lua_pushnumber(L, position.x);
+  lua_pushnumber(L, position.y);
+  lua_pushnumber(L, position.z);
+  return 3;
+}
+
+int VM::character_setPosition(lua_State* L) {
+  Character* character = *((Character**) luaL_checkudata(L, 1, "Character"));
+  const GLfloat x = luaL_checknumber(L, 2);
+  const GLfloat y = luaL_checknumber(L, 3);
+  const GLfloat z = luaL_checknumber(L, 4);
+  character->setPosition(glm::vec3(x, y, z));
+  return 0;
+}
+
+int VM::character_setVelocity(lua_State* L) {
+  Character* character = *((Character**) luaL_checkudata(L, 1, "Character"));
+  const GLfloat x = luaL_checknumber(L, 2);
+  const GLfloat y = luaL_checknumber(L, 3);
+  const GLfloat z = luaL_checknumber(L, 4);
+  character->setVelocity(glm::vec3(x, y, z));
+  return 0;
+}
+
+int VM::character_isOnGround(lua_State* L) {
+  Character* character = *((Character**) luaL_checkudata(L, 1, "Character"));
+  lua_pushboolean(L, character->isOnGround());
+  return 1;
+}
+
+int VM::character_jump(lua_State* L) {
+  Character* character = *((Character**) luaL_checkudata(L, 1, "Character"));
+  const GLfloat speed = luaL_optnumber(L, 2, 10.0);
+  character->jump(speed);
+  return 0;
+}
+
+int VM::character_free(lua_State* L) {
+  Character* character = *((Character**) luaL_checkudata(L, 1, "Character"));
+  delete character;
+  return 0;
+}
+
+int VM::character_new(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  const GLfloat radius = luaL_optnumber(L, 1, 0.5);
+  const GLfloat height = luaL_optnumber(L, 2, 1.0);
+  const GLfloat stepHeight = luaL_optnumber(L, 3, 0.35);
+  const GLfloat maxSlope = luaL_optnumber(L, 4, 45.0);
+  if (radius <= 0.0 || height < 0.0) {
+    lua_pushliteral(L, "Character - radius must be greater than 0");
+    lua_error(L);
+  }
+  *((Character**) lua_newuserdata(L, sizeof(Character*))) = new Character(&vm->physics, radius, height, stepHeight, maxSlope);
+  if (luaL_newmetatable(L, "Character")) {
+    static const luaL_Reg functions[] = {
+      {"getPosition", character_getPosition},
+      {"setPosition", character_setPosition},
+      {"setVelocity", character_setVelocity},
+      {"isOnGround", character_isOnGround},
+      {"jump", character_jump},
+      {"__gc", character_free},
+      {nullptr, nullptr}
+    };
+    lua_pushlightuserdata(L, vm);
+    luaL_setfuncs(L, functions, 1);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+int VM::environment_hasSH(lua_State* L) {
+  Environment* environment = *((Environment**) luaL_checkudata(L, 1, "Environment"));
+  lua_pushboolean(L, environment->getSH() != nullptr);
+  return 1;
+}
+
 int VM::environment_isReady(lua_State* L) {
   Environment* environment = *((Environment**) luaL_checkudata(L, 1, "Environment"));
-  lua_pushboolean(L, environment->getCubemap()->get() != 0);
+  lua_pushboolean(L, environment->isReady());
   return 1;
 }
 
@@ -789,9 +1224,16 @@ int VM::environment_new(lua_State* L) {
     lua_pushliteral(L, "Environment - invalid url");
     lua_error(L);
   }
-  *((Environment**) lua_newuserdata(L, sizeof(Environment*))) = new Environment(&vm->cubemapbuffer, vm->http->request(url));
+  static const char* EnvironmentIrradianceNames[] = {
+    "convolution",
+    "sh",
+    nullptr
+  };
+  const EnvironmentIrradiance irradiance = (EnvironmentIrradiance) luaL_checkoption(L, 2, "convolution", EnvironmentIrradianceNames);
+  *((Environment**) lua_newuserdata(L, sizeof(Environment*))) = new Environment(&vm->cubemapbuffer, vm->http->request(url), &vm->workers, url, irradiance);
   if (luaL_newmetatable(L, "Environment")) {
     static const luaL_Reg functions[] = {
+      {"hasSH", environment_hasSH},
       {"isReady", environment_isReady},
       {"__gc", environment_free},
       {nullptr, nullptr}
@@ -806,6 +1248,7 @@ int VM::environment_new(lua_State* L) {
 
 int VM::framebuffer_bind(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Framebuffer* framebuffer = *((Framebuffer**) luaL_checkudata(L, 1, "Framebuffer"));
   const GLint x = luaL_checkinteger(L, 2);
   const GLint y = luaL_checkinteger(L, 3);
@@ -814,13 +1257,14 @@ int VM::framebuffer_bind(lua_State* L) {
     lua_error(L);
   }
   framebuffer->bind();
-  glViewport(0, 0, x, y);
+  GLState::setViewport(0, 0, x, y);
   vm->camera.setAspect((GLfloat) x / (GLfloat) y);
   return 0;
 }
 
 int VM::framebuffer_blit(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Framebuffer* framebuffer = *((Framebuffer**) luaL_checkudata(L, 1, "Framebuffer"));
   Framebuffer* target = nullptr;
   if (lua_gettop(L) > 1) {
@@ -835,6 +1279,8 @@ int VM::framebuffer_blit(lua_State* L) {
 }
 
 int VM::framebuffer_clear(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Framebuffer* framebuffer = *((Framebuffer**) luaL_checkudata(L, 1, "Framebuffer"));
   if (!framebuffer->isBinded()) {
     lua_pushliteral(L, "Framebuffer::clear - framebuffer is not binded");
@@ -859,6 +1305,8 @@ int VM::framebuffer_setTextureClearColor(lua_State* L) {
 }
 
 int VM::framebuffer_setTextureData(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Framebuffer* framebuffer = *((Framebuffer**) luaL_checkudata(L, 1, "Framebuffer"));
   const GLint index = luaL_checkinteger(L, 2);
   const GLsizei textureSize = framebuffer->width * framebuffer->height * 4;
@@ -882,13 +1330,16 @@ int VM::framebuffer_setTextureData(lua_State* L) {
 
 int VM::framebuffer_unbind(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
-  glViewport(0, 0, vm->window->resolution.x, vm->window->resolution.y);
+  vm->renderQueue.flush();
+  GLState::setViewport(0, 0, vm->window->resolution.x, vm->window->resolution.y);
   vm->camera.setAspect(vm->window->resolution.x / vm->window->resolution.y);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
   return 0;
 }
 
 int VM::framebuffer_free(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   delete *((Framebuffer**) luaL_checkudata(L, 1, "Framebuffer"));
   return 0;
 }
@@ -935,7 +1386,7 @@ int VM::geometry_setColliders(lua_State* L) {
   geometry->colliders.clear();
   geometry->colliders.reserve(count);
   for (int i = 1; i <= count; i += 7) {
-    const GeometryColliderShape shape = (GeometryColliderShape) luaL_checkoption(L, 1, nullptr, GeometryColliderShapeNames);
+    const GeometryColliderShape shape = (GeometryColliderShape) luaL_checkoption(L, i + 1, nullptr, GeometryColliderShapeNames);
     for (int j = 0; j < 3; j++) {
       position[j] = luaL_checknumber(L, i + 2 + j);
     }
@@ -953,6 +1404,8 @@ int VM::geometry_setColliders(lua_State* L) {
 }
 
 int VM::geometry_setIndex(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Geometry* geometry = *((Geometry**) luaL_checkudata(L, 1, "Geometry"));
   int count = lua_gettop(L) - 1;
   if (count == 0 || count % 3 != 0) {
@@ -964,11 +1417,13 @@ int VM::geometry_setIndex(lua_State* L) {
   for (int i = 1; i <= count; i++) {
     geometry->index.push_back(luaL_checkinteger(L, i + 1));
   }
-  geometry->needsUpdate = true;
+  geometry->invalidateIndex(0, geometry->index.size());
   return 0;
 }
 
 int VM::geometry_setVertices(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Geometry* geometry = *((Geometry**) luaL_checkudata(L, 1, "Geometry"));
   int count = lua_gettop(L) - 1;
   if (count == 0 || count % 11 != 0) {
@@ -984,11 +1439,56 @@ int VM::geometry_setVertices(lua_State* L) {
     }
     geometry->vertices.push_back(*(GeometryVertex*) vertex);
   }
-  geometry->needsUpdate = true;
+  geometry->invalidateVertices(0, geometry->vertices.size());
+  return 0;
+}
+
+int VM::geometry_updateIndex(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
+  Geometry* geometry = *((Geometry**) luaL_checkudata(L, 1, "Geometry"));
+  const lua_Integer offset = luaL_checkinteger(L, 2) - 1;
+  const int count = lua_gettop(L) - 2;
+  if (offset < 0 || count == 0 || offset + count > (lua_Integer) geometry->index.size()) {
+    lua_pushliteral(L, "Geometry::updateIndex - range is out of bounds");
+    lua_error(L);
+  }
+  for (int i = 0; i < count; i++) {
+    geometry->index[offset + i] = luaL_checkinteger(L, i + 3);
+  }
+  geometry->invalidateIndex(offset, offset + count);
+  return 0;
+}
+
+int VM::geometry_updateVertices(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
+  Geometry* geometry = *((Geometry**) luaL_checkudata(L, 1, "Geometry"));
+  const lua_Integer offset = luaL_checkinteger(L, 2) - 1;
+  const int count = lua_gettop(L) - 2;
+  if (count == 0 || count % 11 != 0) {
+    lua_pushliteral(L, "Geometry::updateVertices - vertex data must be multiple of 11 (x, y, z,  nx, ny, nz,  u, v,  r, g, b)");
+    lua_error(L);
+  }
+  const int numVertices = count / 11;
+  if (offset < 0 || offset + numVertices > (lua_Integer) geometry->vertices.size()) {
+    lua_pushliteral(L, "Geometry::updateVertices - range is out of bounds");
+    lua_error(L);
+  }
+  GLfloat vertex[11];
+  for (int i = 0; i < numVertices; i++) {
+    for (int j = 0; j < 11; j++) {
+      vertex[j] = luaL_checknumber(L, i * 11 + j + 3);
+    }
+    geometry->vertices[offset + i] = *(GeometryVertex*) vertex;
+  }
+  geometry->invalidateVertices(offset, offset + numVertices);
   return 0;
 }
 
 int VM::geometry_free(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Geometry::gc(
     *((Geometry**) luaL_checkudata(L, 1, "Geometry"))
   );
@@ -997,16 +1497,20 @@ int VM::geometry_free(lua_State* L) {
 
 int VM::geometry_new(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
-  *((Geometry**) lua_newuserdata(L, sizeof(Geometry*))) = new Geometry();
+  const GeometryUsage usage = (GeometryUsage) luaL_checkoption(L, 1, "static", GeometryUsageNames);
+  *((Geometry**) lua_newuserdata(L, sizeof(Geometry*))) = new Geometry(usage);
   if (luaL_newmetatable(L, "Geometry")) {
     static const luaL_Reg functions[] = {
       {"setColliders", geometry_setColliders},
       {"setIndex", geometry_setIndex},
       {"setVertices", geometry_setVertices},
+      {"updateIndex", geometry_updateIndex},
+      {"updateVertices", geometry_updateVertices},
       {"__gc", geometry_free},
       {nullptr, nullptr}
     };
-    luaL_setfuncs(L, functions, 0);
+    lua_pushlightuserdata(L, vm);
+    luaL_setfuncs(L, functions, 1);
     lua_pushvalue(L, -1);
     lua_setfield(L, -2, "__index");
   }
@@ -1098,7 +1602,8 @@ int VM::image_new(lua_State* L) {
     nullptr
   };
   const ImageEncoding encoding = (ImageEncoding) luaL_checkoption(L, 2, "srgb", ImageEncodingNames);
-  *((Image**) lua_newuserdata(L, sizeof(Image*))) = new Image(encoding, vm->http->request(url));
+  const bool compress = lua_toboolean(L, 3);
+  *((Image**) lua_newuserdata(L, sizeof(Image*))) = new Image(encoding, vm->http->request(url), &vm->workers, url, compress);
   if (luaL_newmetatable(L, "Image")) {
     static const luaL_Reg functions[] = {
       {"isReady", image_isReady},
@@ -1211,6 +1716,20 @@ int VM::mesh_enablePhysics(lua_State* L) {
     lua_pushliteral(L, "Mesh::enablePhysics - mesh physics already enabled");
     lua_error(L);
   }
+  Geometry* geometry = mesh->getGeometry();
+  for (const auto& collider : geometry->colliders) {
+    if (collider.shape != GEOMETRY_COLLIDER_MESH) {
+      continue;
+    }
+    if (mass > 0.0) {
+      lua_pushliteral(L, "Mesh::enablePhysics - mesh colliders can only be static");
+      lua_error(L);
+    }
+    if (geometry->index.size() < 3 || geometry->vertices.empty()) {
+      lua_pushliteral(L, "Mesh::enablePhysics - mesh collider geometry has no triangles");
+      lua_error(L);
+    }
+  }
   vm->physics.addBody(mesh, mass, isAlwaysActive, isKinematic);
   return 0;
 }
@@ -1366,6 +1885,58 @@ int VM::mesh_getContactIds(lua_State* L) {
   return count;
 }
 
+int VM::mesh_setInstanceAttribute(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
+  Mesh* mesh = *((Mesh**) luaL_checkudata(L, 1, "Mesh"));
+  const GLint location = luaL_checkinteger(L, 2);
+  const GLint components = luaL_checkinteger(L, 3);
+  luaL_checktype(L, 4, LUA_TTABLE);
+  const GLint divisor = glm::max((GLint) luaL_optinteger(L, 5, 1), (GLint) 0);
+  if (components < 1 || (components > 4 && components != 16)) {
+    lua_pushliteral(L, "Mesh::setInstanceAttribute - components must be 1, 2, 3, 4 or 16");
+    lua_error(L);
+  }
+  if (location < 4 || location + (components == 16 ? 4 : 1) > 16) {
+    lua_pushliteral(L, "Mesh::setInstanceAttribute - location must be between 4 and 15 (12 for mat4)");
+    lua_error(L);
+  }
+  const int count = luaL_len(L, 4);
+  if (count == 0 || count % components != 0) {
+    lua_pushliteral(L, "Mesh::setInstanceAttribute - data must be a multiple of components");
+    lua_error(L);
+  }
+  std::vector<GLfloat> data(count);
+  for (int i = 0; i < count; i++) {
+    lua_rawgeti(L, 4, i + 1);
+    data[i] = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+  }
+  mesh->setInstanceAttribute(location, components, divisor, data);
+  return 0;
+}
+
+int VM::mesh_updateInstanceAttribute(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
+  Mesh* mesh = *((Mesh**) luaL_checkudata(L, 1, "Mesh"));
+  const GLint location = luaL_checkinteger(L, 2);
+  const lua_Integer offset = luaL_checkinteger(L, 3) - 1;
+  luaL_checktype(L, 4, LUA_TTABLE);
+  const int count = luaL_len(L, 4);
+  std::vector<GLfloat> data(count);
+  for (int i = 0; i < count; i++) {
+    lua_rawgeti(L, 4, i + 1);
+    data[i] = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+  }
+  if (offset < 0 || !mesh->updateInstanceAttribute(location, offset, data)) {
+    lua_pushliteral(L, "Mesh::updateInstanceAttribute - range is out of bounds");
+    lua_error(L);
+  }
+  return 0;
+}
+
 int VM::mesh_uniformInt(lua_State* L) {
   Mesh* mesh = *((Mesh**) luaL_checkudata(L, 1, "Mesh"));
   const std::string name = luaL_checkstring(L, 2);
@@ -1390,6 +1961,19 @@ int VM::mesh_uniformTexture(lua_State* L) {
   return 0;
 }
 
+int VM::mesh_uniformSH(lua_State* L) {
+  Mesh* mesh = *((Mesh**) luaL_checkudata(L, 1, "Mesh"));
+  const std::string name = luaL_checkstring(L, 2);
+  const glm::vec3* sh = getSH(L, 3);
+  if (sh == nullptr) {
+    return 0;
+  }
+  for (GLint i = 0; i < 9; i++) {
+    mesh->setUniformVec3(name + "[" + std::to_string(i) + "]", sh[i]);
+  }
+  return 0;
+}
+
 int VM::mesh_uniformVec2(lua_State* L) {
   Mesh* mesh = *((Mesh**) luaL_checkudata(L, 1, "Mesh"));
   const std::string name = luaL_checkstring(L, 2);
@@ -1428,12 +2012,17 @@ int VM::mesh_render(lua_State* L) {
     lua_pushliteral(L, "Mesh::render - No shader attached");
     lua_error(L);
   }
-  mesh->render(&vm->camera, instances);
+  if (vm->renderQueue.isEnabled()) {
+    mesh->enqueue(&vm->camera, &vm->renderQueue, instances);
+  } else {
+    mesh->render(&vm->camera, &vm->drawbuffer, instances);
+  }
   return 0;
 }
 
 int VM::mesh_free(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Mesh* mesh = *((Mesh**) luaL_checkudata(L, 1, "Mesh"));
   btRigidBody* body = mesh->getBody();
   if (body != nullptr) {
@@ -1495,8 +2084,11 @@ int VM::mesh_new(lua_State* L) {
       {"setLinearVelocity", mesh_setLinearVelocity},
       {"getContacts", mesh_getContacts},
       {"getContactIds", mesh_getContactIds},
+      {"setInstanceAttribute", mesh_setInstanceAttribute},
+      {"updateInstanceAttribute", mesh_updateInstanceAttribute},
       {"uniformInt", mesh_uniformInt},
       {"uniformFloat", mesh_uniformFloat},
+      {"uniformSH", mesh_uniformSH},
       {"uniformTexture", mesh_uniformTexture},
       {"uniformVec2", mesh_uniformVec2},
       {"uniformVec3", mesh_uniformVec3},
@@ -1619,6 +2211,8 @@ int VM::shader_getBlend(lua_State* L) {
 }
 
 int VM::shader_setBlend(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   const bool enabled = lua_toboolean(L, 2);
   shader->setBlend(enabled);
@@ -1632,6 +2226,8 @@ int VM::shader_getDepthTest(lua_State* L) {
 }
 
 int VM::shader_setDepthTest(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   const bool enabled = lua_toboolean(L, 2);
   shader->setDepthTest(enabled);
@@ -1645,29 +2241,61 @@ int VM::shader_getFaceCulling(lua_State* L) {
 }
 
 int VM::shader_setFaceCulling(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   const ShaderFaceCulling mode = (ShaderFaceCulling) luaL_checkoption(L, 2, nullptr, ShaderFaceCullingNames);
   shader->setFaceCulling(mode);
   return 0;
 }
 
-int VM::shader_uniformInt(lua_State* L) {
+int VM::shader_getUniform(lua_State* L) {
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   const char* name = luaL_checkstring(L, 2);
+  // Which uniforms are active is only known once the program is linked
+  shader->wait();
+  const GLint uniform = shader->getUniform(name);
+  if (uniform == -1) {
+    return 0;
+  }
+  lua_pushinteger(L, uniform);
+  return 1;
+}
+
+int VM::shader_isReady(lua_State* L) {
+  Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
+  const bool isReady = shader->isReady();
+  if (isReady && !shader->getError().empty()) {
+    lua_pushstring(L, shader->getError().c_str());
+    lua_error(L);
+  }
+  lua_pushboolean(L, isReady);
+  return 1;
+}
+
+int VM::shader_uniformInt(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
+  Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
+  const GLint uniform = getShaderUniform(L, shader, 2);
   const GLint value = luaL_checkinteger(L, 3);
-  shader->setUniformInt(name, value);
+  shader->setUniformInt(uniform, value);
   return 0;
 }
 
 int VM::shader_uniformFloat(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
-  const char* name = luaL_checkstring(L, 2);
+  const GLint uniform = getShaderUniform(L, shader, 2);
   const GLfloat value = luaL_checknumber(L, 3);
-  shader->setUniformFloat(name, value);
+  shader->setUniformFloat(uniform, value);
   return 0;
 }
 
 int VM::shader_uniformTexture(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   const std::string name = luaL_checkstring(L, 2);
   Texture* texture = getTexture(L, 3);
@@ -1675,49 +2303,73 @@ int VM::shader_uniformTexture(lua_State* L) {
   return 0;
 }
 
+int VM::shader_uniformSH(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
+  Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
+  const std::string name = luaL_checkstring(L, 2);
+  const glm::vec3* sh = getSH(L, 3);
+  if (sh == nullptr) {
+    return 0;
+  }
+  for (GLint i = 0; i < 9; i++) {
+    shader->setUniformVec3((name + "[" + std::to_string(i) + "]").c_str(), sh[i]);
+  }
+  return 0;
+}
+
 int VM::shader_uniformVec2(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
-  const char* name = luaL_checkstring(L, 2);
+  const GLint uniform = getShaderUniform(L, shader, 2);
   const GLfloat x = luaL_checknumber(L, 3);
   const GLfloat y = luaL_checknumber(L, 4);
-  shader->setUniformVec2(name, glm::vec2(x, y));
+  shader->setUniformVec2(uniform, glm::vec2(x, y));
   return 0;
 }
 
 int VM::shader_uniformVec3(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
-  const char* name = luaL_checkstring(L, 2);
+  const GLint uniform = getShaderUniform(L, shader, 2);
   const GLfloat x = luaL_checknumber(L, 3);
   const GLfloat y = luaL_checknumber(L, 4);
   const GLfloat z = luaL_checknumber(L, 5);
-  shader->setUniformVec3(name, glm::vec3(x, y, z));
+  shader->setUniformVec3(uniform, glm::vec3(x, y, z));
   return 0;
 }
 
 int VM::shader_uniformVec4(lua_State* L) {
+  VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
-  const char* name = luaL_checkstring(L, 2);
+  const GLint uniform = getShaderUniform(L, shader, 2);
   const GLfloat x = luaL_checknumber(L, 3);
   const GLfloat y = luaL_checknumber(L, 4);
   const GLfloat z = luaL_checknumber(L, 5);
   const GLfloat w = luaL_checknumber(L, 6);
-  shader->setUniformVec4(name, glm::vec4(x, y, z, w));
+  shader->setUniformVec4(uniform, glm::vec4(x, y, z, w));
   return 0;
 }
 
 int VM::shader_render(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   const GLsizei instances = glm::max((GLsizei) luaL_optinteger(L, 2, 0), (GLsizei) 0);
   shader->setCameraUniforms(&vm->camera);
   shader->setTextureUniforms();
-  shader->use();
-  vm->plane.draw(instances);
+  if (shader->use()) {
+    vm->plane.draw(instances);
+  }
   return 0;
 }
 
 int VM::shader_free(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Shader* shader = *((Shader**) luaL_checkudata(L, 1, "Shader"));
   vm->shader_gc(shader);
   return 0;
@@ -1734,6 +2386,9 @@ void VM::shader_gc(Shader* shader) {
   std::erase_if(shaders, [&shader](const Shader* s) {
     return s->id == shader->id;
   });
+  std::erase_if(pendingShaders, [&shader](const Shader* s) {
+    return s->id == shader->id;
+  });
   delete shader;
 }
 
@@ -1741,12 +2396,8 @@ int VM::shader_new(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
   const char* vertexSource = luaL_checkstring(L, 1);
   const char* fragmentSource = luaL_checkstring(L, 2);
-  Shader* shader = new Shader(vertexSource, fragmentSource);
-  if (shader->getError().length()) {
-    lua_pushstring(L, shader->getError().c_str());
-    delete shader;
-    lua_error(L);
-  }
+  const ShaderTransforms transforms = (ShaderTransforms) luaL_checkoption(L, 3, "uniforms", ShaderTransformsNames);
+  Shader* shader = new Shader(vertexSource, fragmentSource, false, false, transforms);
   if (shader->hasUniform("brdfMap")) {
     shader->setUniformTexture("brdfMap", &vm->brdf);
   }
@@ -1754,6 +2405,7 @@ int VM::shader_new(lua_State* L) {
     shader->setUniformTexture("irradianceMap", &vm->irradiance);
   }
   vm->shaders.push_back(shader);
+  vm->pendingShaders.push_back(shader);
   *((Shader**) lua_newuserdata(L, sizeof(Shader*))) = shader;
   if (luaL_newmetatable(L, "Shader")) {
     static const luaL_Reg functions[] = {
@@ -1763,8 +2415,11 @@ int VM::shader_new(lua_State* L) {
       {"setDepthTest", shader_setDepthTest},
       {"getFaceCulling", shader_getFaceCulling},
       {"setFaceCulling", shader_setFaceCulling},
+      {"getUniform", shader_getUniform},
+      {"isReady", shader_isReady},
       {"uniformInt", shader_uniformInt},
       {"uniformFloat", shader_uniformFloat},
+      {"uniformSH", shader_uniformSH},
       {"uniformTexture", shader_uniformTexture},
       {"uniformVec2", shader_uniformVec2},
       {"uniformVec3", shader_uniformVec3},
@@ -1804,6 +2459,7 @@ int VM::voxels_get(lua_State* L) {
 
 int VM::voxels_set(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Voxels* voxels = *((Voxels**) luaL_checkudata(L, 1, "Voxels"));
   const GLint x = luaL_checkinteger(L, 2);
   const GLint y = luaL_checkinteger(L, 3);
@@ -1887,12 +2543,17 @@ int VM::voxels_render(lua_State* L) {
     lua_pushliteral(L, "Voxels::render - No shader attached");
     lua_error(L);
   }
-  voxels->render(&vm->camera);
+  if (vm->renderQueue.isEnabled()) {
+    voxels->enqueue(&vm->camera, &vm->renderQueue);
+  } else {
+    voxels->render(&vm->camera, &vm->drawbuffer);
+  }
   return 0;
 }
 
 int VM::voxels_free(lua_State* L) {
   VM* vm = (VM*) lua_topointer(L, lua_upvalueindex(1));
+  vm->renderQueue.flush();
   Voxels* voxels = *((Voxels**) luaL_checkudata(L, 1, "Voxels"));
   vm->shader_gc(voxels->getShader());
   delete voxels;
@@ -1,18 +1,23 @@
 #pragma once
 
 #include <lua.hpp>
+#include "character.hpp"
 #include "http.hpp"
 #include "physics.hpp"
 #include "sfx.hpp"
 #include "window.hpp"
+#include "workers.hpp"
 #include "../gl/camera.hpp"
 #include "../gl/cubemapbuffer.hpp"
 #include "../gl/environment.hpp"
 #include "../gl/framebuffer.hpp"
 #include "../gl/geometry.hpp"
+#include "../gl/glstate.hpp"
 #include "../gl/image.hpp"
 #include "../gl/mesh.hpp"
 #include "../gl/raycaster.hpp"
+#include "../gl/renderqueue.hpp"
+#include "../gl/sceneindex.hpp"
 #include "../gl/shader.hpp"
 #include "../gl/voxels/volume.hpp"
 #include "../gl/primitives/box.hpp"
@@ -47,10 +52,15 @@ class VM {
     Camera camera;
     glm::vec4 clearColor;
     Cubemapbuffer cubemapbuffer;
+    Drawbuffer drawbuffer;
+    RenderQueue renderQueue;
     Physics physics;
     Raycaster raycaster;
+    SceneIndex scene;
     std::vector<Shader*> shaders;
+    std::vector<Shader*> pendingShaders;
     std::vector<SFX*> sfx;
+    Workers workers;
 
     std::string source;
     GLfloat lastTick;
@@ -68,14 +78,19 @@ class VM {
     void resetGL();
     void logError(std::string msg);
 
+    static GLint getShaderUniform(lua_State* L, Shader* shader, GLint index);
+    static const glm::vec3* getSH(lua_State* L, GLint index);
     static Texture* getTexture(lua_State* L, GLint index);
+    static int pushPhysicsHit(lua_State* L, const PhysicsHit& hit);
 
     static int log(lua_State* L);
     static int clearLog(lua_State* L);
 
     static int info(lua_State* L);
+    static int getStateChanges(lua_State* L);
     static int navigate(lua_State* L);
     static int setClearColor(lua_State* L);
+    static int setRenderQueue(lua_State* L);
     static int showTooltip(lua_State* L);
 
     static int clamp(lua_State* L);
@@ -101,14 +116,36 @@ class VM {
 
     static int physics_getContacts(lua_State* L);
     static int physics_getContactIds(lua_State* L);
+    static int physics_getContactEvents(lua_State* L);
+    static int physics_raycast(lua_State* L);
+    static int physics_raycastBatch(lua_State* L);
     static int physics_setGravity(lua_State* L);
+    static int physics_setThreads(lua_State* L);
+    static int physics_setTimestep(lua_State* L);
+    static int physics_sweep(lua_State* L);
 
     static int raycaster_setFromCamera(lua_State* L);
     static int raycaster_getRay(lua_State* L);
     static int raycaster_getResult(lua_State* L);
     static int raycaster_intersect(lua_State* L);
+    static int raycaster_intersectBatch(lua_State* L);
+
+    static int scene_add(lua_State* L);
+    static int scene_remove(lua_State* L);
+    static int scene_intersect(lua_State* L);
+    static int scene_getInFrustum(lua_State* L);
+    static int scene_getInRadius(lua_State* L);
+
+    static int character_new(lua_State* L);
+    static int character_getPosition(lua_State* L);
+    static int character_setPosition(lua_State* L);
+    static int character_setVelocity(lua_State* L);
+    static int character_isOnGround(lua_State* L);
+    static int character_jump(lua_State* L);
+    static int character_free(lua_State* L);
 
     static int environment_new(lua_State* L);
+    static int environment_hasSH(lua_State* L);
     static int environment_isReady(lua_State* L);
     static int environment_free(lua_State* L);
 
@@ -125,6 +162,8 @@ class VM {
     static int geometry_setColliders(lua_State* L);
     static int geometry_setIndex(lua_State* L);
     static int geometry_setVertices(lua_State* L);
+    static int geometry_updateIndex(lua_State* L);
+    static int geometry_updateVertices(lua_State* L);
     static int geometry_free(lua_State* L);
     void geometry_gc(Geometry* geometry);
 
@@ -160,8 +199,11 @@ class VM {
     static int mesh_setLinearVelocity(lua_State* L);
     static int mesh_getContacts(lua_State* L);
     static int mesh_getContactIds(lua_State* L);
+    static int mesh_setInstanceAttribute(lua_State* L);
+    static int mesh_updateInstanceAttribute(lua_State* L);
     static int mesh_uniformInt(lua_State* L);
     static int mesh_uniformFloat(lua_State* L);
+    static int mesh_uniformSH(lua_State* L);
     static int mesh_uniformTexture(lua_State* L);
     static int mesh_uniformVec2(lua_State* L);
     static int mesh_uniformVec3(lua_State* L);
@@ -186,8 +228,11 @@ class VM {
     static int shader_setDepthTest(lua_State* L);
     static int shader_getFaceCulling(lua_State* L);
     static int shader_setFaceCulling(lua_State* L);
+    static int shader_getUniform(lua_State* L);
+    static int shader_isReady(lua_State* L);
     static int shader_uniformInt(lua_State* L);
     static int shader_uniformFloat(lua_State* L);
+    static int shader_uniformSH(lua_State* L);
     static int shader_uniformTexture(lua_State* L);
     static int shader_uniformVec2(lua_State* L);
     static int shader_uniformVec3(lua_State* L);
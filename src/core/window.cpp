@@ -2,6 +2,7 @@
 #include <iostream>
 #include "lib/icons.hpp"
 #include "lib/roboto.hpp"
+#include "../gl/glstate.hpp"
 
 #ifdef WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
@@ -100,6 +101,7 @@ WindowContext::WindowContext():
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   glDepthFunc(GL_LEQUAL);
   glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  GLState::reset();
   glfwSwapInterval(1);
 
   glfwSetWindowUserPointer(window, (void*) this);
@@ -0,0 +1,53 @@
+#include "workers.hpp"
+#include <algorithm>
+
+static const size_t maxThreads = 4;
+
+Workers::Workers():
+  isRunning(true)
+{
+
+}
+
+Workers::~Workers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isRunning = false;
+    jobs.clear();
+  }
+  condition.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void Workers::run(std::function<void()>&& job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+    if (threads.empty()) {
+      // Leave a core for the main thread
+      const size_t count = std::clamp((size_t) std::thread::hardware_concurrency(), (size_t) 2, maxThreads + 1) - 1;
+      for (size_t i = 0; i < count; i++) {
+        threads.emplace_back(&Workers::work, this);
+      }
+    }
+  }
+  condition.notify_one();
+}
+
+void Workers::work() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return !isRunning || !jobs.empty(); });
+      if (!isRunning) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background threads for CPU work that shouldn't stall a frame (decoding...).
+// They start with the first job. Jobs must not touch GL.
+class Workers {
+  public:
+    Workers();
+    ~Workers();
+    void run(std::function<void()>&& job);
+  private:
+    std::condition_variable condition;
+    bool isRunning;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    void work();
+};
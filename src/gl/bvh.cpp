@@ -0,0 +1,371 @@
+#include "bvh.hpp"
+#include "geometry.hpp"
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+static const GLuint bins = 12;
+static const GLuint maxDepth = 48;
+static const GLuint maxLeafSize = 2;
+
+GeometryBVH::GeometryBVH(const std::vector<GeometryVertex>& vertices, const std::vector<GLushort>& index) {
+  const size_t numVertices = vertices.size();
+  triangles.reserve(index.size() / 3);
+  for (size_t i = 0; i + 2 < index.size(); i += 3) {
+    if (index[i] >= numVertices || index[i + 1] >= numVertices || index[i + 2] >= numVertices) {
+      continue;
+    }
+    triangles.push_back({
+      vertices[index[i]].position,
+      vertices[index[i + 1]].position,
+      vertices[index[i + 2]].position,
+    });
+  }
+  if (triangles.empty()) {
+    return;
+  }
+  centroids.reserve(triangles.size());
+  for (const auto& triangle : triangles) {
+    centroids.push_back((triangle.a + triangle.b + triangle.c) / (GLfloat) 3.0);
+  }
+  // A binary tree over n leaves never has more than 2n - 1 nodes,
+  // so node references stay valid while subdividing.
+  nodes.reserve(triangles.size() * 2);
+  nodes.push_back({ glm::vec3(0.0), 0, glm::vec3(0.0), (GLuint) triangles.size() });
+  updateBounds(nodes[0]);
+  subdivide(0, 0);
+  centroids.clear();
+  centroids.shrink_to_fit();
+}
+
+bool GeometryBVH::intersect(const glm::vec3& origin, const glm::vec3& direction, const bool isFlipped, GLfloat& distance, glm::vec3& normal) const {
+  if (nodes.empty()) {
+    return false;
+  }
+  const GLfloat none = std::numeric_limits<GLfloat>::max();
+  const glm::vec3 inverse = (GLfloat) 1.0 / direction;
+  if (intersectBounds(nodes[0], origin, inverse, distance) == none) {
+    return false;
+  }
+  bool hit = false;
+  GLuint stack[maxDepth + 1];
+  GLuint stackSize = 0;
+  const Node* node = &nodes[0];
+  while (true) {
+    if (node->count > 0) {
+      for (GLuint i = node->first, l = node->first + node->count; i < l; i++) {
+        const Triangle& triangle = triangles[i];
+        // Mirroring transforms flip the winding the world space test would see
+        const glm::vec3& b = isFlipped ? triangle.c : triangle.b;
+        const glm::vec3& c = isFlipped ? triangle.b : triangle.c;
+        const GLfloat d = intersectTriangle(origin, direction, triangle.a, b, c);
+        if (d != 0.0 && d < distance) {
+          distance = d;
+          normal = glm::cross(b - triangle.a, c - triangle.a);
+          hit = true;
+        }
+      }
+      if (stackSize == 0) {
+        break;
+      }
+      node = &nodes[stack[--stackSize]];
+      continue;
+    }
+    GLuint closest = node->first;
+    GLuint furthest = node->first + 1;
+    GLfloat closestDistance = intersectBounds(nodes[closest], origin, inverse, distance);
+    GLfloat furthestDistance = intersectBounds(nodes[furthest], origin, inverse, distance);
+    if (closestDistance > furthestDistance) {
+      std::swap(closest, furthest);
+      std::swap(closestDistance, furthestDistance);
+    }
+    if (closestDistance == none) {
+      if (stackSize == 0) {
+        break;
+      }
+      node = &nodes[stack[--stackSize]];
+      continue;
+    }
+    node = &nodes[closest];
+    if (furthestDistance != none) {
+      stack[stackSize++] = furthest;
+    }
+  }
+  return hit;
+}
+
+GLuint GeometryBVH::intersectPacket(const glm::vec3* origins, const glm::vec3* directions, const GLuint mask, const bool isFlipped, GLfloat* distances, glm::vec3* normals) const {
+  if (nodes.empty() || mask == 0) {
+    return 0;
+  }
+  // The whole packet walks the tree together: a node is visited once
+  // if any of the active rays enters it, which keeps coherent rays
+  // (like the ones fanned out from a camera or an emitter) cache friendly.
+  // The slab and triangle tests run on all the lanes at once without branching.
+  const GLfloat none = std::numeric_limits<GLfloat>::max();
+  Packet packet;
+  for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+    for (GLint axis = 0; axis < 3; axis++) {
+      packet.origin[axis][r] = origins[r][axis];
+      packet.direction[axis][r] = directions[r][axis];
+      packet.inverse[axis][r] = (GLfloat) 1.0 / directions[r][axis];
+    }
+    packet.active[r] = (mask >> r) & 1;
+  }
+  if (intersectPacketBounds(nodes[0], packet, distances) == none) {
+    return 0;
+  }
+  GLuint hits[GeometryBVHPacketSize] = {};
+  GLuint stack[maxDepth + 1];
+  GLuint stackSize = 0;
+  const Node* node = &nodes[0];
+  while (true) {
+    if (node->count > 0) {
+      for (GLuint i = node->first, l = node->first + node->count; i < l; i++) {
+        intersectPacketTriangle(packet, triangles[i], isFlipped, i + 1, distances, hits);
+      }
+      if (stackSize == 0) {
+        break;
+      }
+      node = &nodes[stack[--stackSize]];
+      continue;
+    }
+    GLuint closest = node->first;
+    GLuint furthest = node->first + 1;
+    GLfloat closestDistance = intersectPacketBounds(nodes[closest], packet, distances);
+    GLfloat furthestDistance = intersectPacketBounds(nodes[furthest], packet, distances);
+    if (closestDistance > furthestDistance) {
+      std::swap(closest, furthest);
+      std::swap(closestDistance, furthestDistance);
+    }
+    if (closestDistance == none) {
+      if (stackSize == 0) {
+        break;
+      }
+      node = &nodes[stack[--stackSize]];
+      continue;
+    }
+    node = &nodes[closest];
+    if (furthestDistance != none) {
+      stack[stackSize++] = furthest;
+    }
+  }
+  // Lanes only track the closest triangle. The normals are resolved once at the end.
+  GLuint result = 0;
+  for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+    if (hits[r] == 0) {
+      continue;
+    }
+    const Triangle& triangle = triangles[hits[r] - 1];
+    const glm::vec3& b = isFlipped ? triangle.c : triangle.b;
+    const glm::vec3& c = isFlipped ? triangle.b : triangle.c;
+    normals[r] = glm::cross(b - triangle.a, c - triangle.a);
+    result |= 1 << r;
+  }
+  return result;
+}
+
+void GeometryBVH::subdivide(const GLuint index, const GLuint depth) {
+  Node& node = nodes[index];
+  if (node.count <= maxLeafSize || depth >= maxDepth) {
+    return;
+  }
+
+  struct Bin {
+    glm::vec3 min;
+    glm::vec3 max;
+    GLuint count;
+  };
+  const GLfloat none = std::numeric_limits<GLfloat>::max();
+  GLfloat bestCost = node.count * getArea(node.min, node.max);
+  GLint bestAxis = -1;
+  GLfloat bestSplit = 0.0;
+  for (GLint axis = 0; axis < 3; axis++) {
+    GLfloat lower = none;
+    GLfloat upper = -none;
+    for (GLuint i = node.first, l = node.first + node.count; i < l; i++) {
+      lower = std::min(lower, centroids[i][axis]);
+      upper = std::max(upper, centroids[i][axis]);
+    }
+    if (lower == upper) {
+      continue;
+    }
+    Bin bin[bins];
+    for (GLuint b = 0; b < bins; b++) {
+      bin[b] = { glm::vec3(none), glm::vec3(-none), 0 };
+    }
+    const GLfloat scale = (GLfloat) bins / (upper - lower);
+    for (GLuint i = node.first, l = node.first + node.count; i < l; i++) {
+      const Triangle& triangle = triangles[i];
+      const GLuint b = std::min(bins - 1, (GLuint) ((centroids[i][axis] - lower) * scale));
+      bin[b].count++;
+      bin[b].min = glm::min(glm::min(glm::min(bin[b].min, triangle.a), triangle.b), triangle.c);
+      bin[b].max = glm::max(glm::max(glm::max(bin[b].max, triangle.a), triangle.b), triangle.c);
+    }
+    GLfloat leftArea[bins - 1], rightArea[bins - 1];
+    GLuint leftCount[bins - 1], rightCount[bins - 1];
+    glm::vec3 leftMin(none), leftMax(-none), rightMin(none), rightMax(-none);
+    GLuint leftSum = 0, rightSum = 0;
+    for (GLuint b = 0; b < bins - 1; b++) {
+      leftSum += bin[b].count;
+      leftCount[b] = leftSum;
+      leftMin = glm::min(leftMin, bin[b].min);
+      leftMax = glm::max(leftMax, bin[b].max);
+      leftArea[b] = leftSum > 0 ? getArea(leftMin, leftMax) : 0.0;
+      rightSum += bin[bins - 1 - b].count;
+      rightCount[bins - 2 - b] = rightSum;
+      rightMin = glm::min(rightMin, bin[bins - 1 - b].min);
+      rightMax = glm::max(rightMax, bin[bins - 1 - b].max);
+      rightArea[bins - 2 - b] = rightSum > 0 ? getArea(rightMin, rightMax) : 0.0;
+    }
+    for (GLuint b = 0; b < bins - 1; b++) {
+      const GLfloat cost = leftCount[b] * leftArea[b] + rightCount[b] * rightArea[b];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = lower + (b + 1) / scale;
+      }
+    }
+  }
+  if (bestAxis == -1) {
+    return;
+  }
+
+  GLuint i = node.first;
+  GLuint j = node.first + node.count - 1;
+  while (i <= j) {
+    if (centroids[i][bestAxis] < bestSplit) {
+      i++;
+    } else {
+      std::swap(triangles[i], triangles[j]);
+      std::swap(centroids[i], centroids[j]);
+      if (j == 0) {
+        break;
+      }
+      j--;
+    }
+  }
+  const GLuint leftCount = i - node.first;
+  if (leftCount == 0 || leftCount == node.count) {
+    return;
+  }
+
+  const GLuint left = nodes.size();
+  nodes.push_back({ glm::vec3(0.0), node.first, glm::vec3(0.0), leftCount });
+  nodes.push_back({ glm::vec3(0.0), i, glm::vec3(0.0), node.count - leftCount });
+  node.first = left;
+  node.count = 0;
+  updateBounds(nodes[left]);
+  updateBounds(nodes[left + 1]);
+  subdivide(left, depth + 1);
+  subdivide(left + 1, depth + 1);
+}
+
+void GeometryBVH::updateBounds(Node& node) {
+  const GLfloat none = std::numeric_limits<GLfloat>::max();
+  node.min = glm::vec3(none);
+  node.max = glm::vec3(-none);
+  for (GLuint i = node.first, l = node.first + node.count; i < l; i++) {
+    const Triangle& triangle = triangles[i];
+    node.min = glm::min(glm::min(glm::min(node.min, triangle.a), triangle.b), triangle.c);
+    node.max = glm::max(glm::max(glm::max(node.max, triangle.a), triangle.b), triangle.c);
+  }
+}
+
+GLfloat GeometryBVH::getArea(const glm::vec3& min, const glm::vec3& max) {
+  const glm::vec3 e = max - min;
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+GLfloat GeometryBVH::intersectBounds(const Node& node, const glm::vec3& origin, const glm::vec3& inverse, const GLfloat distance) {
+  const glm::vec3 t1 = (node.min - origin) * inverse;
+  const glm::vec3 t2 = (node.max - origin) * inverse;
+  const glm::vec3 tmin = glm::min(t1, t2);
+  const glm::vec3 tmax = glm::max(t1, t2);
+  const GLfloat enter = glm::max(glm::max(tmin.x, tmin.y), tmin.z);
+  const GLfloat leave = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+  if (leave >= enter && leave > 0.0 && enter < distance) {
+    return enter;
+  }
+  return std::numeric_limits<GLfloat>::max();
+}
+
+GLfloat GeometryBVH::intersectPacketBounds(const Node& node, const Packet& packet, const GLfloat* distances) {
+  const GLfloat none = std::numeric_limits<GLfloat>::max();
+  GLfloat enter[GeometryBVHPacketSize];
+  for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+    GLfloat tmin = -none;
+    GLfloat tmax = none;
+    for (GLint axis = 0; axis < 3; axis++) {
+      const GLfloat t1 = (node.min[axis] - packet.origin[axis][r]) * packet.inverse[axis][r];
+      const GLfloat t2 = (node.max[axis] - packet.origin[axis][r]) * packet.inverse[axis][r];
+      tmin = std::max(tmin, std::min(t1, t2));
+      tmax = std::min(tmax, std::max(t1, t2));
+    }
+    const bool isInside = packet.active[r] && tmax >= tmin && tmax > 0.0 && tmin < distances[r];
+    enter[r] = isInside ? tmin : none;
+  }
+  GLfloat closest = none;
+  for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+    closest = std::min(closest, enter[r]);
+  }
+  return closest;
+}
+
+void GeometryBVH::intersectPacketTriangle(const Packet& packet, const Triangle& triangle, const bool isFlipped, const GLuint index, GLfloat* distances, GLuint* hits) {
+  // Same test as intersectTriangle, with the triangle terms shared by the lanes
+  const glm::vec3& a = triangle.a;
+  const glm::vec3 edge1 = (isFlipped ? triangle.c : triangle.b) - a;
+  const glm::vec3 edge2 = (isFlipped ? triangle.b : triangle.c) - a;
+  const glm::vec3 normal = glm::cross(edge1, edge2);
+  const GLfloat* ox = packet.origin[0];
+  const GLfloat* oy = packet.origin[1];
+  const GLfloat* oz = packet.origin[2];
+  const GLfloat* dx = packet.direction[0];
+  const GLfloat* dy = packet.direction[1];
+  const GLfloat* dz = packet.direction[2];
+  for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+    const GLfloat DdN = -(dx[r] * normal.x + dy[r] * normal.y + dz[r] * normal.z);
+    const GLfloat qx = ox[r] - a.x, qy = oy[r] - a.y, qz = oz[r] - a.z;
+    // direction . (diff x edge2) and direction . (edge1 x diff)
+    const GLfloat DdQxE2 = -(
+      dx[r] * (qy * edge2.z - qz * edge2.y)
+      + dy[r] * (qz * edge2.x - qx * edge2.z)
+      + dz[r] * (qx * edge2.y - qy * edge2.x)
+    );
+    const GLfloat DdE1xQ = -(
+      dx[r] * (edge1.y * qz - edge1.z * qy)
+      + dy[r] * (edge1.z * qx - edge1.x * qz)
+      + dz[r] * (edge1.x * qy - edge1.y * qx)
+    );
+    const GLfloat QdN = qx * normal.x + qy * normal.y + qz * normal.z;
+    const GLfloat t = QdN / DdN;
+    const bool isHit = (
+      packet.active[r]
+      && DdN > 0.0
+      && DdQxE2 >= 0.0
+      && DdE1xQ >= 0.0
+      && DdQxE2 + DdE1xQ <= DdN
+      && QdN > 0.0
+      && t < distances[r]
+    );
+    distances[r] = isHit ? t : distances[r];
+    hits[r] = isHit ? index : hits[r];
+  }
+}
+
+GLfloat GeometryBVH::intersectTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+  const glm::vec3 edge1 = b - a;
+  const glm::vec3 edge2 = c - a;
+  const glm::vec3 normal = glm::cross(edge1, edge2);
+  const GLfloat DdN = -glm::dot(direction, normal);
+  if (DdN <= 0.0) return 0.0;
+  const glm::vec3 diff = origin - a;
+  const GLfloat DdQxE2 = -glm::dot(direction, glm::cross(diff, edge2));
+  if (DdQxE2 < 0.0) return 0.0;
+  const GLfloat DdE1xQ = -glm::dot(direction, glm::cross(edge1, diff));
+  if (DdE1xQ < 0.0 || (DdQxE2 + DdE1xQ) > DdN) return 0.0;
+  const GLfloat QdN = glm::dot(diff, normal);
+  if (QdN < 0.0) return 0.0;
+  return QdN / DdN;
+}
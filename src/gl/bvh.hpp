@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+struct GeometryVertex;
+
+static const GLuint GeometryBVHPacketSize = 4;
+
+// Binned SAH bounding volume hierarchy over the triangles of a geometry.
+// Lives in object space so it only needs rebuilding when the geometry changes.
+class GeometryBVH {
+  public:
+    GeometryBVH(const std::vector<GeometryVertex>& vertices, const std::vector<GLushort>& index);
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, const bool isFlipped, GLfloat& distance, glm::vec3& normal) const;
+    GLuint intersectPacket(const glm::vec3* origins, const glm::vec3* directions, const GLuint mask, const bool isFlipped, GLfloat* distances, glm::vec3* normals) const;
+  private:
+    struct Node {
+      glm::vec3 min;
+      GLuint first;
+      glm::vec3 max;
+      GLuint count;
+    };
+    struct Triangle {
+      glm::vec3 a;
+      glm::vec3 b;
+      glm::vec3 c;
+    };
+    // One lane per ray, laid out so the per lane loops vectorize
+    struct Packet {
+      GLfloat origin[3][GeometryBVHPacketSize];
+      GLfloat direction[3][GeometryBVHPacketSize];
+      GLfloat inverse[3][GeometryBVHPacketSize];
+      GLuint active[GeometryBVHPacketSize];
+    };
+    std::vector<glm::vec3> centroids;
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    void subdivide(const GLuint index, const GLuint depth);
+    void updateBounds(Node& node);
+    static GLfloat getArea(const glm::vec3& min, const glm::vec3& max);
+    static GLfloat intersectBounds(const Node& node, const glm::vec3& origin, const glm::vec3& inverse, const GLfloat distance);
+    static GLfloat intersectPacketBounds(const Node& node, const Packet& packet, const GLfloat* distances);
+    static void intersectPacketTriangle(const Packet& packet, const Triangle& triangle, const bool isFlipped, const GLuint index, GLfloat* distances, GLuint* hits);
+    static GLfloat intersectTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+};
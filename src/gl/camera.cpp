@@ -6,10 +6,34 @@ const GLfloat Camera::nearPlane = 0.1;
 const GLfloat Camera::farPlane = 10000.0;
 const glm::vec3 Camera::worldUp = glm::vec3(0.0, 1.0, 0.0);
 
-Camera::Camera(): aspect(0), fov(0), version(1) {
+Camera::Camera(): aspect(0), bufferVersion(0), fov(0), version(1) {
+  glCreateBuffers(1, &buffer);
+  glNamedBufferStorage(buffer, sizeof(glm::mat4) * 2 + sizeof(glm::vec4), nullptr, GL_DYNAMIC_STORAGE_BIT);
   reset();
 }
 
+Camera::~Camera() {
+  GLState::deleteBuffers(1, &buffer);
+}
+
+void Camera::bindBuffer() {
+  updateBuffer();
+  glBindBufferBase(GL_UNIFORM_BUFFER, CameraBufferBinding, buffer);
+}
+
+void Camera::updateBuffer() {
+  if (bufferVersion != version) {
+    bufferVersion = version;
+    // std140 layout of the CameraUniforms block in the shader headers
+    const struct {
+      glm::mat4 viewMatrix;
+      glm::mat4 projectionMatrix;
+      glm::vec4 viewPosition;
+    } data = { view, projection, glm::vec4(position, 1.0) };
+    glNamedBufferSubData(buffer, 0, sizeof(data), &data);
+  }
+}
+
 void Camera::lookAt(const glm::vec3& value) {
   front = glm::normalize(value - position);
   updateView();
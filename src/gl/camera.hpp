@@ -5,9 +5,15 @@
 #include <glm/glm.hpp>
 #include "geometry.hpp"
 
+// Matches the CameraUniforms block binding in the shader headers
+static const GLuint CameraBufferBinding = 0;
+
 class Camera {
   public:
     Camera();
+    ~Camera();
+    void bindBuffer();
+    void updateBuffer();
     void lookAt(const glm::vec3& value);
     void setAspect(const GLfloat value);
     const GLfloat getFov();
@@ -22,6 +28,8 @@ class Camera {
     void reset();
   private:
     GLfloat aspect;
+    GLuint buffer;
+    GLuint bufferVersion;
     glm::vec3 front;
     struct {
       glm::vec3 normal;
@@ -4,12 +4,17 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// Renders with its own projection/view for every face. They get their own
+// names, as the fragment header already declares the camera ones in a block.
 static const char* vertexShader =
 R""""(
+layout (location = 0) in vec3 position;
+uniform mat4 faceProjection;
+uniform mat4 faceView;
 out vec3 vPos;
 void main() {
   vPos = position;
-  gl_Position = projectionMatrix * viewMatrix * vec4(position, 1.0);
+  gl_Position = faceProjection * faceView * vec4(position, 1.0);
 }
 )"""";
 
@@ -61,6 +66,15 @@ void main() {
 }
 )"""";
 
+static const char* fragmentShaderIrradianceSH =
+R""""(
+in vec3 vPos;
+uniform vec3 sh[9];
+void main() {
+  gl_FragColor = vec4(irradianceSH(sh, normalize(vPos)), 1.0);
+}
+)"""";
+
 static const char* fragmentShaderPrefiltered =
 R""""(
 const float PI = 3.14159265359;
@@ -158,25 +172,28 @@ static const glm::mat4 views[] = {
 
 Cubemapbuffer::Cubemapbuffer():
   box(2, 2, 2),
-  shaderCubemap(vertexShader, fragmentShaderCubemap),
-  shaderIrradiance(vertexShader, fragmentShaderIrradiance),
-  shaderPrefiltered(vertexShader, fragmentShaderPrefiltered)
+  shaderCubemap(vertexShader, fragmentShaderCubemap, true),
+  shaderIrradiance(vertexShader, fragmentShaderIrradiance, true),
+  shaderIrradianceSH(vertexShader, fragmentShaderIrradianceSH, true),
+  shaderPrefiltered(vertexShader, fragmentShaderPrefiltered, true)
 {
   glGenFramebuffers(1, &fbo);
   glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
   shaderCubemap.setFaceCulling(SHADER_FACE_CULLING_FRONT);
   shaderCubemap.setUniformInt("equirectangularMap", 0);
-  shaderCubemap.setUniformMat4("projectionMatrix", projection);
+  shaderCubemap.setUniformMat4("faceProjection", projection);
   shaderIrradiance.setFaceCulling(SHADER_FACE_CULLING_FRONT);
   shaderIrradiance.setUniformInt("environmentMap", 0);
-  shaderIrradiance.setUniformMat4("projectionMatrix", projection);
+  shaderIrradiance.setUniformMat4("faceProjection", projection);
+  shaderIrradianceSH.setFaceCulling(SHADER_FACE_CULLING_FRONT);
+  shaderIrradianceSH.setUniformMat4("faceProjection", projection);
   shaderPrefiltered.setFaceCulling(SHADER_FACE_CULLING_FRONT);
   shaderPrefiltered.setUniformInt("environmentMap", 0);
-  shaderPrefiltered.setUniformMat4("projectionMatrix", projection);
+  shaderPrefiltered.setUniformMat4("faceProjection", projection);
 }
 
 Cubemapbuffer::~Cubemapbuffer() {
-  glDeleteFramebuffers(1, &fbo);
+  GLState::deleteFramebuffers(1, &fbo);
 }
 
 void Cubemapbuffer::renderHDR(
@@ -189,59 +206,128 @@ void Cubemapbuffer::renderHDR(
 ) {
   GLuint input;
   glGenTextures(1, &input);
-  glBindTexture(GL_TEXTURE_2D, input);
+  GLState::bindTexture(GL_TEXTURE_2D, input);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  GLState::bindTexture(GL_TEXTURE_2D, 0);
 
   create(output, outputWidth, outputHeight, true);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, input);
+  GLState::bindTexture(0, GL_TEXTURE_2D, input);
   render(output, outputWidth, outputHeight, shaderCubemap);
-  glBindTexture(GL_TEXTURE_2D, 0);
-  glDeleteTextures(1, &input);
+  GLState::bindTexture(GL_TEXTURE_2D, 0);
+  GLState::deleteTextures(1, &input);
 
-  glBindTexture(GL_TEXTURE_CUBE_MAP, output);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, output);
   glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
 void Cubemapbuffer::renderIrradiance(
   GLuint input,
   GLuint& output,
   GLint outputWidth,
-  GLint outputHeight
+  GLint outputHeight,
+  const GLint face
 ) {
-  create(output, outputWidth, outputHeight);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, input);
-  render(output, outputWidth, outputHeight, shaderIrradiance);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  if (face <= 0) {
+    create(output, outputWidth, outputHeight);
+  }
+  GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, input);
+  render(output, outputWidth, outputHeight, shaderIrradiance, 0, face);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
   // dump(output, outputWidth, outputHeight);
 }
 
+void Cubemapbuffer::renderIrradianceSH(
+  const glm::vec3* sh,
+  GLuint& output,
+  GLint outputWidth,
+  GLint outputHeight
+) {
+  // Nine multiply-adds per texel, so all the faces go at once
+  create(output, outputWidth, outputHeight);
+  for (GLint i = 0; i < 9; i++) {
+    shaderIrradianceSH.setUniformVec3(("sh[" + std::to_string(i) + "]").c_str(), sh[i]);
+  }
+  render(output, outputWidth, outputHeight, shaderIrradianceSH);
+}
+
 void Cubemapbuffer::renderPrefiltered(
   GLuint input,
   GLuint& output,
   GLint outputWidth,
-  GLint outputHeight
+  GLint outputHeight,
+  const GLint mip,
+  const GLint face
 ) {
-  create(output, outputWidth, outputHeight, true);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, output);
-  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, input);
-  render(output, outputWidth, outputHeight, shaderPrefiltered, 5);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  if (mip <= 0 && face <= 0) {
+    create(output, outputWidth, outputHeight, true);
+    GLState::bindTexture(GL_TEXTURE_CUBE_MAP, output);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  }
+  GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, input);
+  const GLuint from = mip == -1 ? 0 : mip;
+  const GLuint to = mip == -1 ? CubemapbufferPrefilteredLevels : mip + 1;
+  for (GLuint level = from; level < to; level++) {
+    shaderPrefiltered.setUniformFloat("roughness", (GLfloat) level / (GLfloat) (CubemapbufferPrefilteredLevels - 1.0));
+    render(output, outputWidth, outputHeight, shaderPrefiltered, level, face);
+  }
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void Cubemapbuffer::load(GLuint& output, const GLint width, const GLint height, const bool trilinear, const GLuint levels, const char* data) {
+  // Levels past the stored ones (if any) are left to glGenerateMipmap
+  create(output, width, height, trilinear);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, output);
+  if (trilinear && levels > 1) {
+    // Allocates the chain, like renderPrefiltered does
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  }
+  for (GLuint level = 0; level < levels; level++) {
+    const GLint mipWidth = glm::max(width >> level, 1);
+    const GLint mipHeight = glm::max(height >> level, 1);
+    for (GLint i = 0; i < 6; i++) {
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, 0, 0, mipWidth, mipHeight, GL_RGB, GL_HALF_FLOAT, data);
+      data += getSize(mipWidth, mipHeight, 1) / 6;
+    }
+  }
+  if (trilinear && levels == 1) {
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  }
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void Cubemapbuffer::store(const GLuint input, const GLint width, const GLint height, const GLuint levels, std::vector<char>& data) {
+  size_t offset = data.size();
+  data.resize(offset + getSize(width, height, levels));
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, input);
+  for (GLuint level = 0; level < levels; level++) {
+    const GLint mipWidth = glm::max(width >> level, 1);
+    const GLint mipHeight = glm::max(height >> level, 1);
+    for (GLint i = 0; i < 6; i++) {
+      glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGB, GL_HALF_FLOAT, data.data() + offset);
+      offset += getSize(mipWidth, mipHeight, 1) / 6;
+    }
+  }
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+size_t Cubemapbuffer::getSize(const GLint width, const GLint height, const GLuint levels) {
+  // RGB half floats, all faces. Rows are always 4-byte aligned at these sizes.
+  size_t size = 0;
+  for (GLuint level = 0; level < levels; level++) {
+    size += (size_t) glm::max(width >> level, 1) * glm::max(height >> level, 1) * 6 * 3 * sizeof(GLushort);
+  }
+  return size;
 }
 
 void Cubemapbuffer::create(GLuint& texture, const GLint width, const GLint height, const bool trilinear) {
-  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, texture);
   for (GLint i = 0; i < 6; i++) {
     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
   }
@@ -254,38 +340,28 @@ void Cubemapbuffer::create(GLuint& texture, const GLint width, const GLint heigh
   } else {
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   }
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
-void Cubemapbuffer::render(const GLuint output, const GLint width, const GLint height, Shader& shader, const GLuint mipLevels) {
-  GLint framebuffer;
-  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
-  GLint viewport[4];
-  glGetIntegerv(GL_VIEWPORT, viewport);
+void Cubemapbuffer::render(const GLuint output, const GLint width, const GLint height, Shader& shader, const GLuint mip, const GLint face) {
+  const GLuint framebuffer = GLState::getFramebuffer();
+  const GLint* current = GLState::getViewport();
+  const GLint viewport[4] = { current[0], current[1], current[2], current[3] };
   shader.use();
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
-  for (GLuint mip = 0; mip < mipLevels; mip++) {
-    if (mipLevels > 1) {
-      GLuint mipWidth  = width * glm::pow(0.5, mip);
-      GLuint mipHeight = height * glm::pow(0.5, mip);
-      glViewport(0, 0, mipWidth, mipHeight);
-      shader.setUniformFloat("roughness", (GLfloat) mip / (GLfloat) (mipLevels - 1.0));
-    } else {
-      glViewport(0, 0, width, height);
-    }
-    for (GLint i = 0; i < 6; i++) {
-      shader.setUniformMat4("viewMatrix", views[i]);
-      glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, output, mip);
-      glClear(GL_COLOR_BUFFER_BIT);
-      box.draw();
-    }
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+  GLState::setViewport(0, 0, glm::max(width >> mip, 1), glm::max(height >> mip, 1));
+  for (GLint i = face == -1 ? 0 : face; i < (face == -1 ? 6 : face + 1); i++) {
+    shader.setUniformMat4("faceView", views[i]);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, output, mip);
+    glClear(GL_COLOR_BUFFER_BIT);
+    box.draw();
   }
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
-  glViewport(viewport[0], viewport[1], (GLsizei) viewport[2], (GLsizei) viewport[3]);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  GLState::setViewport(viewport[0], viewport[1], (GLsizei) viewport[2], (GLsizei) viewport[3]);
 }
 
 void Cubemapbuffer::dump(const GLuint texture, const GLint width, const GLint height) {
-  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, texture);
   const GLsizei count = width * height * 3;
   GLfloat* pixels = new GLfloat[count];
   std::ofstream ofs("./dump.hpp");
@@ -308,5 +384,5 @@ void Cubemapbuffer::dump(const GLuint texture, const GLint width, const GLint he
   ofs.close();
   delete[] pixels;
 
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
@@ -4,21 +4,32 @@
 #include <GLFW/glfw3.h>
 #include "primitives/box.hpp"
 #include "shader.hpp"
+#include <glm/glm.hpp>
+#include <vector>
 
+static const GLuint CubemapbufferPrefilteredLevels = 5;
+
+// The irradiance and prefiltered passes can render a single face
+// (and mip) per call, so callers can spread them across frames.
 class Cubemapbuffer {
   public:
     Cubemapbuffer();
     ~Cubemapbuffer();
     void renderHDR(GLfloat* data, GLint width, GLint height, GLuint& output, GLint outputWidth, GLint outputHeight);
-    void renderIrradiance(GLuint input, GLuint& output, GLint outputWidth, GLint outputHeight);
-    void renderPrefiltered(GLuint input, GLuint& output, GLint outputWidth, GLint outputHeight);
+    void renderIrradiance(GLuint input, GLuint& output, GLint outputWidth, GLint outputHeight, const GLint face = -1);
+    void renderIrradianceSH(const glm::vec3* sh, GLuint& output, GLint outputWidth, GLint outputHeight);
+    void renderPrefiltered(GLuint input, GLuint& output, GLint outputWidth, GLint outputHeight, const GLint mip = -1, const GLint face = -1);
+    void load(GLuint& output, const GLint width, const GLint height, const bool trilinear, const GLuint levels, const char* data);
+    void store(const GLuint input, const GLint width, const GLint height, const GLuint levels, std::vector<char>& data);
+    static size_t getSize(const GLint width, const GLint height, const GLuint levels);
   private:
     GLuint fbo;
     BoxGeometry box;
     Shader shaderCubemap;
     Shader shaderIrradiance;
+    Shader shaderIrradianceSH;
     Shader shaderPrefiltered;
     void create(GLuint& texture, const GLint width, const GLint height, const bool trilinear = false);
-    void render(const GLuint output, const GLint width, const GLint height, Shader& shader, const GLuint mipLevels = 1);
+    void render(const GLuint output, const GLint width, const GLint height, Shader& shader, const GLuint mip = 0, const GLint face = -1);
     void dump(const GLuint texture, const GLint width, const GLint height);
 };
@@ -0,0 +1,92 @@
+#include "drawbuffer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+
+static const GLuint frames = 3;
+// std430: mat4 + mat3 stored as three vec4 columns
+static const GLsizeiptr entrySize = sizeof(GLfloat) * (16 + 12);
+
+Drawbuffer::Drawbuffer():
+  alignment(0),
+  buffer(0),
+  capacity(0),
+  cursor(0),
+  fences{ nullptr, nullptr, nullptr },
+  frame(0),
+  mapped(nullptr)
+{
+  GLint value;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &value);
+  alignment = value;
+  allocate(entrySize * 1024);
+}
+
+Drawbuffer::~Drawbuffer() {
+  for (GLuint i = 0; i < frames; i++) {
+    if (fences[i] != nullptr) {
+      glDeleteSync(fences[i]);
+    }
+  }
+  GLState::deleteBuffers(1, &buffer);
+}
+
+void Drawbuffer::bind(const glm::mat4& modelMatrix, const glm::mat3& normalMatrix) {
+  write(bind(1), 0, modelMatrix, normalMatrix);
+}
+
+GLfloat* Drawbuffer::bind(const GLsizei count) {
+  const GLsizeiptr size = entrySize * count;
+  GLsizeiptr offset = ((cursor + alignment - 1) / alignment) * alignment;
+  if (offset + size > capacity) {
+    allocate(std::max(capacity * 2, size + alignment));
+    offset = 0;
+  }
+  offset += capacity * frame;
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DrawbufferBinding, buffer, offset, size);
+  cursor = offset - capacity * frame + size;
+  return (GLfloat*) (mapped + offset);
+}
+
+void Drawbuffer::nextFrame() {
+  if (fences[frame] != nullptr) {
+    glDeleteSync(fences[frame]);
+  }
+  fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frame = (frame + 1) % frames;
+  if (fences[frame] != nullptr) {
+    while (glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fences[frame]);
+    fences[frame] = nullptr;
+  }
+  cursor = 0;
+}
+
+void Drawbuffer::write(GLfloat* entries, const GLsizei index, const glm::mat4& modelMatrix, const glm::mat3& normalMatrix) {
+  GLfloat* entry = entries + (entrySize / sizeof(GLfloat)) * index;
+  std::memcpy(entry, glm::value_ptr(modelMatrix), sizeof(GLfloat) * 16);
+  for (GLint i = 0; i < 3; i++) {
+    std::memcpy(entry + 16 + i * 4, glm::value_ptr(normalMatrix[i]), sizeof(GLfloat) * 3);
+  }
+}
+
+void Drawbuffer::allocate(const GLsizeiptr size) {
+  // The old buffer stays alive in the driver until the draws using it are done,
+  // so growing mid-frame just starts writing into a fresh one.
+  if (buffer != 0) {
+    GLState::deleteBuffers(1, &buffer);
+  }
+  for (GLuint i = 0; i < frames; i++) {
+    if (fences[i] != nullptr) {
+      glDeleteSync(fences[i]);
+      fences[i] = nullptr;
+    }
+  }
+  capacity = ((size + alignment - 1) / alignment) * alignment;
+  cursor = 0;
+  frame = 0;
+  const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glCreateBuffers(1, &buffer);
+  glNamedBufferStorage(buffer, capacity * frames, nullptr, flags);
+  mapped = (GLubyte*) glMapNamedBufferRange(buffer, 0, capacity * frames, flags);
+}
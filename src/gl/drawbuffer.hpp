@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include "glstate.hpp"
+
+// Matches the MeshUniforms block binding in the shader headers
+static const GLuint DrawbufferBinding = 1;
+
+// Persistent-mapped ring of per-draw model/normal matrices, bound with
+// glBindBufferRange for shaders using the MeshUniforms storage block.
+// A range can hold several entries so merged draws index them per instance.
+class Drawbuffer {
+  public:
+    Drawbuffer();
+    ~Drawbuffer();
+    void bind(const glm::mat4& modelMatrix, const glm::mat3& normalMatrix);
+    GLfloat* bind(const GLsizei count);
+    void nextFrame();
+    static void write(GLfloat* entries, const GLsizei index, const glm::mat4& modelMatrix, const glm::mat3& normalMatrix);
+  private:
+    GLsizeiptr alignment;
+    GLuint buffer;
+    GLsizeiptr capacity;
+    GLsizeiptr cursor;
+    GLsync fences[3];
+    GLuint frame;
+    GLubyte* mapped;
+    void allocate(const GLsizeiptr size);
+};
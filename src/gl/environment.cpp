@@ -1,93 +1,90 @@
 #include "environment.hpp"
+#include "../core/cache.hpp"
+#include <cstring>
 #include <stb_image.h>
 
+static const GLint cubemapSize = 512;
+static const GLint irradianceSize = 32;
+static const GLint prefilteredSize = 128;
+// Decoding, then a face per step for irradiance (or a single one from the SH)
+// and a face per mip for prefiltered
+static const GLuint prefilteredSteps = CubemapbufferPrefilteredLevels * 6;
+// Face renders all environments can do per frame
+static const GLuint stepsPerFrame = 1;
+
 GLuint Environment::environmentId = 1;
+GLuint Environment::stepsBudget = stepsPerFrame;
 
 class EnvironmentMap: public Texture {
   public:
-    EnvironmentMap(Cubemapbuffer* buffer, HTTPRequest* request): Texture(GL_TEXTURE_CUBE_MAP), buffer(buffer), request(request) {}
-    ~EnvironmentMap() {
-      if (request != nullptr) {
-        delete request;
-      }
-    }
+    Environment* environment;
+    bool isReady;
+    EnvironmentMap(Environment* environment): Texture(GL_TEXTURE_CUBE_MAP), environment(environment), isReady(false) {}
     GLuint get() {
-      if (texture == 0) {
-        update();
-      }
-      return texture;
-    }
-  private:
-    Cubemapbuffer* buffer;
-    HTTPRequest* request;
-    void update() {
-      if (request != nullptr && request->isReady) {
-        if (request->response.status >= 200 && request->response.status < 400 && request->response.size > 0) {
-          GLint x, y, n;
-          GLfloat* data = stbi_loadf_from_memory(request->response.data, request->response.size, &x, &y, &n, 3);
-          if (data != nullptr) {
-            glGenTextures(1, &texture);
-            buffer->renderHDR(data, x, y, texture, 512, 512);
-            stbi_image_free(data);
-          }
-        }
-        delete request;
-        request = nullptr;
+      if (!isReady && environment != nullptr) {
+        environment->update();
       }
+      return isReady ? texture : 0;
     }
-};
-
-class IrradianceMap: public Texture {
-  public:
-    IrradianceMap(Cubemapbuffer* buffer, Texture* environmentMap): Texture(GL_TEXTURE_CUBE_MAP), buffer(buffer), environmentMap(environmentMap) {}
-    GLuint get() {
+    GLuint& getTexture() {
       if (texture == 0) {
-        GLuint environment = environmentMap->get();
-        if (environment == 0) {
-          return 0;
-        }
         glGenTextures(1, &texture);
-        buffer->renderIrradiance(environment, texture, 32, 32);
       }
       return texture;
     }
-  private:
-    Cubemapbuffer* buffer;
-    Texture* environmentMap;
 };
 
-class PrefilteredMap: public Texture {
-  public:
-    PrefilteredMap(Cubemapbuffer* buffer, Texture* environmentMap): Texture(GL_TEXTURE_CUBE_MAP), buffer(buffer), environmentMap(environmentMap) {}
-    GLuint get() {
-      if (texture == 0) {
-        GLuint environment = environmentMap->get();
-        if (environment == 0) {
-          return 0;
-        }
-        glGenTextures(1, &texture);
-        buffer->renderPrefiltered(environment, texture, 128, 128);
-      }
-      return texture;
-    }
-  private:
-    Cubemapbuffer* buffer;
-    Texture* environmentMap;
-};
+static size_t getCacheSize() {
+  return (
+    Cubemapbuffer::getSize(cubemapSize, cubemapSize, 1)
+    + Cubemapbuffer::getSize(irradianceSize, irradianceSize, 1)
+    + Cubemapbuffer::getSize(prefilteredSize, prefilteredSize, CubemapbufferPrefilteredLevels)
+    + sizeof(glm::vec3) * 9
+  );
+}
+
+EnvironmentDecoding::~EnvironmentDecoding() {
+  if (request != nullptr) {
+    delete request;
+  }
+  if (pixels != nullptr) {
+    stbi_image_free(pixels);
+  }
+}
 
-Environment::Environment(Cubemapbuffer* buffer, HTTPRequest* request):
+Environment::Environment(Cubemapbuffer* buffer, HTTPRequest* request, Workers* workers, const std::string& url, const EnvironmentIrradiance irradianceMode):
   id(environmentId++),
-  cubemap(new EnvironmentMap(buffer, request)),
-  irradiance(new IrradianceMap(buffer, cubemap)),
-  prefiltered(new PrefilteredMap(buffer, cubemap))
+  buffer(buffer),
+  cubemap(new EnvironmentMap(this)),
+  decoding(nullptr),
+  irradiance(new EnvironmentMap(this)),
+  irradianceMode(irradianceMode),
+  prefiltered(new EnvironmentMap(this)),
+  request(request),
+  hasSH(false),
+  step(0),
+  url(url),
+  workers(workers)
 {
-
+  request->onReady = [this]() {
+    decode();
+  };
 }
 
 Environment::~Environment() {
-  Texture::gc(cubemap);
-  Texture::gc(irradiance);
-  Texture::gc(prefiltered);
+  // The maps can outlive this if a shader or mesh still holds them
+  for (EnvironmentMap* map : { cubemap, irradiance, prefiltered }) {
+    map->environment = nullptr;
+    Texture::gc(map);
+  }
+  if (request != nullptr) {
+    delete request;
+  }
+}
+
+bool Environment::isReady() {
+  update();
+  return prefiltered->isReady;
 }
 
 Texture* Environment::getCubemap() {
@@ -101,3 +98,177 @@ Texture* Environment::getIrradiance() {
 Texture* Environment::getPrefiltered() {
   return prefiltered;
 }
+
+const glm::vec3* Environment::getSH() {
+  // The coefficients come straight from the decode, way before the maps
+  if (!hasSH && decoding != nullptr && decoding->isDone.load(std::memory_order_acquire) && decoding->hasSH) {
+    std::memcpy(sh, decoding->sh, sizeof(sh));
+    hasSH = true;
+  }
+  return hasSH ? sh : nullptr;
+}
+
+void Environment::update() {
+  // Only a few face renders run per frame (across all environments),
+  // so generating the maps never stalls a single frame.
+  const GLuint lastStep = getLastStep();
+  while (step < lastStep && stepsBudget > 0) {
+    if (decoding == nullptr || !decoding->isDone.load(std::memory_order_acquire)) {
+      return;
+    }
+    getSH();
+    stepsBudget--;
+    generate();
+  }
+}
+
+void Environment::nextFrame() {
+  stepsBudget = stepsPerFrame;
+}
+
+void Environment::decode() {
+  // The worker only reads the response. It gets freed back on the main thread,
+  // since this runs from the request's own ready callback.
+  decoding = std::make_shared<EnvironmentDecoding>();
+  decoding->request = request;
+  request = nullptr;
+  // Changing the map sizes invalidates the cached ones
+  const std::string seed = (
+    url + "\n" + std::to_string(cubemapSize) + "/" + std::to_string(irradianceSize) + "/" + std::to_string(prefilteredSize)
+    + (irradianceMode == ENVIRONMENT_IRRADIANCE_SH ? "/sh" : "")
+  );
+  workers->run([decoding = decoding, seed]() {
+    const HTTPResponse& response = decoding->request->response;
+    if (response.status >= 200 && response.status < 400 && response.size > 0) {
+      decoding->key = Cache::key(Cache::hash(response.data, response.size, Cache::hash(seed.data(), seed.size())));
+      if (Cache::read("environments", decoding->key, decoding->cached) && decoding->cached.size() == getCacheSize()) {
+        std::memcpy(decoding->sh, decoding->cached.data() + decoding->cached.size() - sizeof(decoding->sh), sizeof(decoding->sh));
+        decoding->hasSH = true;
+      } else {
+        GLint n;
+        decoding->cached.clear();
+        decoding->pixels = stbi_loadf_from_memory(response.data, response.size, &decoding->width, &decoding->height, &n, 3);
+        if (decoding->pixels != nullptr) {
+          projectSH(decoding->pixels, decoding->width, decoding->height, decoding->sh);
+          decoding->hasSH = true;
+        }
+      }
+    }
+    decoding->isDone.store(true, std::memory_order_release);
+  });
+}
+
+void Environment::generate() {
+  const GLuint irradianceSteps = getIrradianceSteps();
+  const GLuint lastStep = getLastStep();
+  if (step == 0) {
+    delete decoding->request;
+    decoding->request = nullptr;
+    if (!decoding->cached.empty()) {
+      load();
+      return;
+    }
+    if (decoding->pixels == nullptr) {
+      step = lastStep;
+      decoding = nullptr;
+      return;
+    }
+    // The skybox can be used while the rest gets generated
+    buffer->renderHDR(decoding->pixels, decoding->width, decoding->height, cubemap->getTexture(), cubemapSize, cubemapSize);
+    stbi_image_free(decoding->pixels);
+    decoding->pixels = nullptr;
+    cubemap->isReady = true;
+  } else if (irradianceMode == ENVIRONMENT_IRRADIANCE_SH && step == 1) {
+    buffer->renderIrradianceSH(sh, irradiance->getTexture(), irradianceSize, irradianceSize);
+    irradiance->isReady = true;
+  } else if (step <= irradianceSteps) {
+    const GLint face = step - 1;
+    buffer->renderIrradiance(cubemap->getTexture(), irradiance->getTexture(), irradianceSize, irradianceSize, face);
+    irradiance->isReady = step == irradianceSteps;
+  } else {
+    const GLuint index = step - 1 - irradianceSteps;
+    buffer->renderPrefiltered(cubemap->getTexture(), prefiltered->getTexture(), prefilteredSize, prefilteredSize, index / 6, index % 6);
+  }
+  step++;
+  if (step == lastStep) {
+    prefiltered->isReady = true;
+    store();
+    decoding = nullptr;
+  }
+}
+
+void Environment::load() {
+  const char* data = decoding->cached.data();
+  buffer->load(cubemap->getTexture(), cubemapSize, cubemapSize, true, 1, data);
+  data += Cubemapbuffer::getSize(cubemapSize, cubemapSize, 1);
+  buffer->load(irradiance->getTexture(), irradianceSize, irradianceSize, false, 1, data);
+  data += Cubemapbuffer::getSize(irradianceSize, irradianceSize, 1);
+  buffer->load(prefiltered->getTexture(), prefilteredSize, prefilteredSize, true, CubemapbufferPrefilteredLevels, data);
+  cubemap->isReady = irradiance->isReady = prefiltered->isReady = true;
+  step = getLastStep();
+  decoding = nullptr;
+}
+
+void Environment::store() {
+  // Reading the maps back waits for them once. Writing goes to the workers.
+  std::vector<char> data;
+  buffer->store(cubemap->getTexture(), cubemapSize, cubemapSize, 1, data);
+  buffer->store(irradiance->getTexture(), irradianceSize, irradianceSize, 1, data);
+  buffer->store(prefiltered->getTexture(), prefilteredSize, prefilteredSize, CubemapbufferPrefilteredLevels, data);
+  data.insert(data.end(), (const char*) sh, (const char*) sh + sizeof(sh));
+  workers->run([key = decoding->key, data = std::move(data)]() {
+    Cache::write("environments", key, data.data(), data.size());
+  });
+}
+
+GLuint Environment::getIrradianceSteps() {
+  return irradianceMode == ENVIRONMENT_IRRADIANCE_SH ? 1 : 6;
+}
+
+GLuint Environment::getLastStep() {
+  return 1 + getIrradianceSteps() + prefilteredSteps;
+}
+
+void Environment::projectSH(const GLfloat* pixels, const GLint width, const GLint height, glm::vec3* sh) {
+  // Projects the equirectangular radiance (same mapping as Cubemapbuffer::renderHDR,
+  // rows bottom-up) into the nine L2 coefficients, weighting each texel by its solid angle.
+  const GLfloat PI = 3.14159265359f;
+  std::vector<GLfloat> cosPhi(width), sinPhi(width);
+  for (GLint x = 0; x < width; x++) {
+    const GLfloat phi = (((GLfloat) x + 0.5f) / (GLfloat) width - 0.5f) * 2.0f * PI;
+    cosPhi[x] = cos(phi);
+    sinPhi[x] = sin(phi);
+  }
+  for (GLint i = 0; i < 9; i++) {
+    sh[i] = glm::vec3(0.0f);
+  }
+  for (GLint y = 0; y < height; y++) {
+    const GLfloat latitude = (((GLfloat) y + 0.5f) / (GLfloat) height - 0.5f) * PI;
+    const GLfloat radius = cos(latitude);
+    const GLfloat dy = sin(latitude);
+    const GLfloat solidAngle = (2.0f * PI / (GLfloat) width) * (PI / (GLfloat) height) * radius;
+    // Summing per row first keeps the float accumulation precise on big maps
+    glm::vec3 row[9];
+    for (GLint i = 0; i < 9; i++) {
+      row[i] = glm::vec3(0.0f);
+    }
+    const GLfloat* pixel = pixels + (size_t) y * width * 3;
+    for (GLint x = 0; x < width; x++, pixel += 3) {
+      const GLfloat dx = radius * cosPhi[x];
+      const GLfloat dz = radius * sinPhi[x];
+      const glm::vec3 color(pixel[0], pixel[1], pixel[2]);
+      row[0] += color * 0.282095f;
+      row[1] += color * (0.488603f * dy);
+      row[2] += color * (0.488603f * dz);
+      row[3] += color * (0.488603f * dx);
+      row[4] += color * (1.092548f * dx * dy);
+      row[5] += color * (1.092548f * dy * dz);
+      row[6] += color * (0.315392f * (3.0f * dz * dz - 1.0f));
+      row[7] += color * (1.092548f * dx * dz);
+      row[8] += color * (0.546274f * (dx * dx - dy * dy));
+    }
+    for (GLint i = 0; i < 9; i++) {
+      sh[i] += row[i] * solidAngle;
+    }
+  }
+}
@@ -2,21 +2,69 @@
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 #include "../core/http.hpp"
+#include "../core/workers.hpp"
 #include "cubemapbuffer.hpp"
 #include "texture.hpp"
 
+enum EnvironmentIrradiance {
+  ENVIRONMENT_IRRADIANCE_CONVOLUTION,
+  ENVIRONMENT_IRRADIANCE_SH,
+};
+
+// Shared with the worker decoding it, so the environment can go away mid-decode
+struct EnvironmentDecoding {
+  std::atomic<bool> isDone = false;
+  HTTPRequest* request = nullptr;
+  std::string key;
+  std::vector<char> cached;
+  GLfloat* pixels = nullptr;
+  GLint width = 0;
+  GLint height = 0;
+  bool hasSH = false;
+  glm::vec3 sh[9];
+  ~EnvironmentDecoding();
+};
+
+class EnvironmentMap;
+
 class Environment {
   public:
     const GLuint id;
-    Environment(Cubemapbuffer* buffer, HTTPRequest* request);
+    Environment(Cubemapbuffer* buffer, HTTPRequest* request, Workers* workers, const std::string& url, const EnvironmentIrradiance irradianceMode = ENVIRONMENT_IRRADIANCE_CONVOLUTION);
     ~Environment();
+    bool isReady();
     Texture* getCubemap();
     Texture* getIrradiance();
     Texture* getPrefiltered();
+    const glm::vec3* getSH();
+    void update();
+    static void nextFrame();
   private:
     static GLuint environmentId;
-    Texture* cubemap;
-    Texture* irradiance;
-    Texture* prefiltered;
+    Cubemapbuffer* buffer;
+    EnvironmentMap* cubemap;
+    std::shared_ptr<EnvironmentDecoding> decoding;
+    EnvironmentMap* irradiance;
+    const EnvironmentIrradiance irradianceMode;
+    EnvironmentMap* prefiltered;
+    HTTPRequest* request;
+    bool hasSH;
+    glm::vec3 sh[9];
+    GLuint step;
+    const std::string url;
+    Workers* workers;
+    static GLuint stepsBudget;
+    void decode();
+    void generate();
+    GLuint getIrradianceSteps();
+    GLuint getLastStep();
+    void load();
+    void store();
+    static void projectSH(const GLfloat* pixels, const GLint width, const GLint height, glm::vec3* sh);
 };
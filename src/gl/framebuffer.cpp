@@ -19,7 +19,7 @@ Framebuffer::Framebuffer(const GLint numTextures, const bool depth, const GLint
 }
 
 Framebuffer::~Framebuffer() {
-  glDeleteFramebuffers(1, &fbo);
+  GLState::deleteFramebuffers(1, &fbo);
   for (const auto& texture : textures) {
     Texture::gc(texture);
   }
@@ -29,13 +29,11 @@ Framebuffer::~Framebuffer() {
 }
 
 bool Framebuffer::isBinded() {
-  GLint current;
-  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &current);
-  return current == fbo;
+  return GLState::getFramebuffer() == fbo;
 }
 
 void Framebuffer::bind() {
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
 }
 
 Texture* Framebuffer::getTexture(const GLint index) {
@@ -49,9 +47,9 @@ void Framebuffer::blit(Framebuffer* target, GLint targetWidth, GLint targetHeigh
   if (target != nullptr) {
     target->bind();
   } else {
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
   }
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  GLState::bindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
   std::vector<GLenum> buffers;
   for (GLint i = 0, l = textures.size(); i < l; i++) {
     buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
@@ -65,8 +63,8 @@ void Framebuffer::blit(Framebuffer* target, GLint targetWidth, GLint targetHeigh
   }
   glDrawBuffers(buffers.size(), buffers.data());
   glReadBuffer(0);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  GLState::bindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
 
 void Framebuffer::clear() {
@@ -83,17 +81,17 @@ bool Framebuffer::setSize(GLint width, GLint height) {
 
   this->width = width;
   this->height = height;
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
   std::vector<GLenum> buffers;
 
   if (multisampled) {
     for (GLint i = 0; const auto& texture : textures) {
       buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
-      glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture->get());
+      GLState::bindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture->get());
       glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, GL_RGBA32F, width, height, GL_TRUE);
       glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i++, GL_TEXTURE_2D_MULTISAMPLE, texture->get(), 0);
     }
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    GLState::bindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
 
     if (depth) {
       glBindRenderbuffer(GL_RENDERBUFFER, rbo);
@@ -104,13 +102,13 @@ bool Framebuffer::setSize(GLint width, GLint height) {
   } else {
     for (GLint i = 0; const auto& texture : textures) {
       buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
-      glBindTexture(GL_TEXTURE_2D, texture->get());
+      GLState::bindTexture(GL_TEXTURE_2D, texture->get());
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
       glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i++, GL_TEXTURE_2D, texture->get(), 0);
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::bindTexture(GL_TEXTURE_2D, 0);
 
     if (depth) {
       glBindRenderbuffer(GL_RENDERBUFFER, rbo);
@@ -124,7 +122,7 @@ bool Framebuffer::setSize(GLint width, GLint height) {
 
   bool status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
 
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
   return status;
 }
@@ -141,10 +139,9 @@ bool Framebuffer::setTextureData(const GLint index, const GLfloat* data) {
   if (multisampled || index < 0 || index >= textures.size()) {
     return false;
   }
-  GLint binding;
-  glGetIntegerv(GL_TEXTURE_BINDING_2D, &binding);
-  glBindTexture(GL_TEXTURE_2D, textures.at(index)->get());
+  const GLuint binding = GLState::getTexture(GL_TEXTURE_2D);
+  GLState::bindTexture(GL_TEXTURE_2D, textures.at(index)->get());
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, data);
-  glBindTexture(GL_TEXTURE_2D, binding);
+  GLState::bindTexture(GL_TEXTURE_2D, binding);
   return true;
 }
@@ -1,9 +1,18 @@
 #include "geometry.hpp"
+#include "bvh.hpp"
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstring>
+
+// Stream geometry writes each upload into the next of these regions,
+// so the CPU never overwrites data a previous frame is still drawing.
+static const GLuint streamSlots = 3;
+// Nanoseconds to wait for a region before switching to new buffers
+static const GLuint64 streamWaitTimeout = 2000000;
 
 GLuint Geometry::geometryId = 1;
 
-Geometry::Geometry():
+Geometry::Geometry(const GeometryUsage usage):
   id(geometryId++),
   refs(1),
   bounds({ glm::vec3(0.0, 0.0, 0.0 ), 0.0 }),
@@ -11,7 +20,18 @@ Geometry::Geometry():
   isValid(false),
   needsUpdate(true),
   needsUpload(false),
-  version(1)
+  version(1),
+  bvh(nullptr),
+  bvhVersion(0),
+  usage(usage),
+  dirtyIndex({ 0, 0 }),
+  dirtyVertices({ 0, 0 }),
+  indexCapacity(0),
+  vertexCapacity(0),
+  fences{ nullptr, nullptr, nullptr },
+  mappedIndex(nullptr),
+  mappedVertices(nullptr),
+  slot(0)
 {
   glGenBuffers(1, &ebo);
   glGenVertexArrays(1, &vao);
@@ -19,9 +39,15 @@ Geometry::Geometry():
 }
 
 Geometry::~Geometry() {
-  glDeleteBuffers(1, &ebo);
-  glDeleteVertexArrays(1, &vao);
-  glDeleteBuffers(1, &vbo);
+  for (GLuint i = 0; i < streamSlots; i++) {
+    if (fences[i] != nullptr) {
+      glDeleteSync(fences[i]);
+    }
+  }
+  GLState::deleteBuffers(1, &ebo);
+  GLState::deleteVertexArrays(1, &vao);
+  GLState::deleteBuffers(1, &vbo);
+  delete bvh;
 }
 
 void Geometry::gc(Geometry* geometry) {
@@ -43,10 +69,47 @@ GeometryBounds Geometry::getBounds(const glm::mat4& transform) {
   return transformed;
 }
 
+const GeometryBVH* Geometry::getBVH() {
+  if (needsUpdate) {
+    update();
+  }
+  if (bvh == nullptr || bvhVersion != version) {
+    delete bvh;
+    bvh = new GeometryBVH(vertices, index);
+    bvhVersion = version;
+  }
+  return bvh;
+}
+
 const GLuint Geometry::getVersion() {
+  if (needsUpdate) {
+    update();
+  }
   return version;
 }
 
+GeometryUsage Geometry::getUsage() {
+  return usage;
+}
+
+void Geometry::invalidateIndex(const size_t from, const size_t to) {
+  if (dirtyIndex.from >= dirtyIndex.to) {
+    dirtyIndex = { from, to };
+  } else {
+    dirtyIndex = { std::min(dirtyIndex.from, from), std::max(dirtyIndex.to, to) };
+  }
+  needsUpdate = true;
+}
+
+void Geometry::invalidateVertices(const size_t from, const size_t to) {
+  if (dirtyVertices.from >= dirtyVertices.to) {
+    dirtyVertices = { from, to };
+  } else {
+    dirtyVertices = { std::min(dirtyVertices.from, from), std::max(dirtyVertices.to, to) };
+  }
+  needsUpdate = true;
+}
+
 GLfloat Geometry::getMaxScaleOnAxis(const glm::mat4& transform) {
   const GLfloat* t = glm::value_ptr(transform);
   const GLfloat scaleXSq = t[0] * t[0] + t[1] * t[1] + t[2] * t[2];
@@ -55,7 +118,7 @@ GLfloat Geometry::getMaxScaleOnAxis(const glm::mat4& transform) {
   return sqrt(fmax(fmax(scaleXSq, scaleYSq), scaleZSq));
 }
 
-void Geometry::draw(const GLsizei instances) {
+void Geometry::draw(const GLsizei instances, const std::vector<GeometryInstanceAttribute>* instanceAttributes, const GLuint baseInstance) {
   if (needsUpdate) {
     update();
   }
@@ -65,13 +128,60 @@ void Geometry::draw(const GLsizei instances) {
   if (needsUpload) {
     upload();
   }
-  glBindVertexArray(vao);
-  if (instances > 0) {
-    glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0, instances);
+  GLState::bindVertexArray(vao);
+  if (instanceAttributes != nullptr) {
+    for (const auto& attribute : *instanceAttributes) {
+      bindInstanceAttribute(attribute);
+    }
+  }
+  if (usage == GEOMETRY_USAGE_STREAM) {
+    const void* offset = (void*) (sizeof(GLushort) * indexCapacity * slot);
+    const GLint baseVertex = vertexCapacity * slot;
+    if (instances > 0) {
+      glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, offset, instances, baseVertex, baseInstance);
+    } else {
+      glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, offset, baseVertex);
+    }
+    if (fences[slot] != nullptr) {
+      glDeleteSync(fences[slot]);
+    }
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  } else if (instances > 0) {
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0, instances, baseInstance);
   } else {
     glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0);
   }
-  glBindVertexArray(0);
+  if (instanceAttributes != nullptr) {
+    // The VAO is shared by every mesh using this geometry
+    for (const auto& attribute : *instanceAttributes) {
+      unbindInstanceAttribute(attribute);
+    }
+  }
+  // The VAO stays bound so consecutive draws of this geometry skip the rebind
+}
+
+void Geometry::bindInstanceAttribute(const GeometryInstanceAttribute& attribute) {
+  GLState::bindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+  if (attribute.components == 16) {
+    // mat4 attributes take 4 consecutive locations, one per column
+    for (GLuint i = 0; i < 4; i++) {
+      glEnableVertexAttribArray(attribute.location + i);
+      glVertexAttribPointer(attribute.location + i, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16, (void *) (sizeof(GLfloat) * 4 * i));
+      glVertexAttribDivisor(attribute.location + i, attribute.divisor);
+    }
+  } else {
+    glEnableVertexAttribArray(attribute.location);
+    glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * attribute.components, (void *) 0);
+    glVertexAttribDivisor(attribute.location, attribute.divisor);
+  }
+}
+
+void Geometry::unbindInstanceAttribute(const GeometryInstanceAttribute& attribute) {
+  const GLuint locations = attribute.components == 16 ? 4 : 1;
+  for (GLuint i = 0; i < locations; i++) {
+    glDisableVertexAttribArray(attribute.location + i);
+    glVertexAttribDivisor(attribute.location + i, 0);
+  }
 }
 
 void Geometry::update() {
@@ -99,14 +209,48 @@ void Geometry::update() {
   version++;
 }
 
-void Geometry::upload() {
-  needsUpload = false;
-  count = index.size();
-  glBindVertexArray(vao);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * index.size(), index.data(), GL_STATIC_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(GeometryVertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+void Geometry::allocate(const size_t numIndices, const size_t numVertices) {
+  indexCapacity = numIndices;
+  vertexCapacity = numVertices;
+  if (usage != GEOMETRY_USAGE_STATIC) {
+    // Leave some room so growing geometry doesn't reallocate every time
+    indexCapacity += indexCapacity / 2;
+    vertexCapacity += vertexCapacity / 2;
+  }
+  GLState::bindVertexArray(vao);
+  if (usage == GEOMETRY_USAGE_STREAM) {
+    // Buffer storage is immutable, so growing a stream needs new buffers
+    for (GLuint i = 0; i < streamSlots; i++) {
+      if (fences[i] != nullptr) {
+        glDeleteSync(fences[i]);
+        fences[i] = nullptr;
+      }
+    }
+    if (mappedIndex != nullptr) {
+      GLState::deleteBuffers(1, &ebo);
+      GLState::deleteBuffers(1, &vbo);
+      glGenBuffers(1, &ebo);
+      glGenBuffers(1, &vbo);
+    }
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr indexSize = sizeof(GLushort) * indexCapacity * streamSlots;
+    const GLsizeiptr vertexSize = sizeof(GeometryVertex) * vertexCapacity * streamSlots;
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indexSize, nullptr, flags);
+    mappedIndex = (GLushort*) glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indexSize, flags);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferStorage(GL_ARRAY_BUFFER, vertexSize, nullptr, flags);
+    mappedVertices = (GeometryVertex*) glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexSize, flags);
+    slot = 0;
+  } else {
+    // Static buffers are exactly the geometry size, so they get filled right away
+    const bool isStatic = usage == GEOMETRY_USAGE_STATIC;
+    const GLenum hint = isStatic ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW;
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indexCapacity, isStatic ? index.data() : nullptr, hint);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GeometryVertex) * vertexCapacity, isStatic ? vertices.data() : nullptr, hint);
+  }
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GeometryVertex), (void *) 0);
   glEnableVertexAttribArray(1);
@@ -115,5 +259,74 @@ void Geometry::upload() {
   glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GeometryVertex), (void *) (sizeof(GLfloat) * 6));
   glEnableVertexAttribArray(3);
   glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(GeometryVertex), (void *) (sizeof(GLfloat) * 8));
-  glBindVertexArray(0);
+  GLState::bindVertexArray(0);
+}
+
+void Geometry::upload() {
+  needsUpload = false;
+  count = index.size();
+  const size_t numIndices = index.size();
+  const size_t numVertices = vertices.size();
+  // Without a recorded range, the whole geometry was replaced
+  const bool isFullUpload = dirtyIndex.from >= dirtyIndex.to && dirtyVertices.from >= dirtyVertices.to;
+  GeometryRange indexRange = isFullUpload ? GeometryRange{ 0, numIndices } : dirtyIndex;
+  GeometryRange vertexRange = isFullUpload ? GeometryRange{ 0, numVertices } : dirtyVertices;
+  dirtyIndex = { 0, 0 };
+  dirtyVertices = { 0, 0 };
+  if (
+    usage == GEOMETRY_USAGE_STATIC
+    || numIndices > indexCapacity
+    || numVertices > vertexCapacity
+  ) {
+    allocate(numIndices, numVertices);
+    if (usage == GEOMETRY_USAGE_STATIC) {
+      return;
+    }
+    indexRange = { 0, numIndices };
+    vertexRange = { 0, numVertices };
+  }
+
+  if (usage == GEOMETRY_USAGE_STREAM) {
+    slot = (slot + 1) % streamSlots;
+    if (fences[slot] != nullptr) {
+      // Waits a bit for the GPU to be done with this region. If it's still busy, this
+      // moves to fresh buffers instead of spinning. The driver keeps the old ones
+      // alive until the draws using them are done.
+      const GLenum status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, streamWaitTimeout);
+      if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+        allocate(numIndices, numVertices);
+      } else {
+        glDeleteSync(fences[slot]);
+        fences[slot] = nullptr;
+      }
+    }
+    // Every region holds a full copy, so the whole geometry gets written
+    std::memcpy(mappedIndex + indexCapacity * slot, index.data(), sizeof(GLushort) * numIndices);
+    std::memcpy(mappedVertices + vertexCapacity * slot, vertices.data(), sizeof(GeometryVertex) * numVertices);
+    return;
+  }
+
+  indexRange.to = std::min(indexRange.to, numIndices);
+  vertexRange.to = std::min(vertexRange.to, numVertices);
+  GLState::bindVertexArray(vao);
+  if (indexRange.from < indexRange.to) {
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferSubData(
+      GL_ELEMENT_ARRAY_BUFFER,
+      sizeof(GLushort) * indexRange.from,
+      sizeof(GLushort) * (indexRange.to - indexRange.from),
+      index.data() + indexRange.from
+    );
+  }
+  GLState::bindVertexArray(0);
+  if (vertexRange.from < vertexRange.to) {
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(
+      GL_ARRAY_BUFFER,
+      sizeof(GeometryVertex) * vertexRange.from,
+      sizeof(GeometryVertex) * (vertexRange.to - vertexRange.from),
+      vertices.data() + vertexRange.from
+    );
+    GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+  }
 }
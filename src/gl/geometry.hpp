@@ -4,6 +4,9 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include "glstate.hpp"
+
+class GeometryBVH;
 
 struct GeometryBounds {
   glm::vec3 position;
@@ -15,6 +18,7 @@ enum GeometryColliderShape {
   GEOMETRY_COLLIDER_CAPSULE,
   GEOMETRY_COLLIDER_CYLINDER,
   GEOMETRY_COLLIDER_SPHERE,
+  GEOMETRY_COLLIDER_MESH,
 };
 
 static const char* GeometryColliderShapeNames[] = {
@@ -22,6 +26,7 @@ static const char* GeometryColliderShapeNames[] = {
   "capsule",
   "cylinder",
   "sphere",
+  "mesh",
   nullptr
 };
 
@@ -31,6 +36,32 @@ struct GeometryCollider {
   glm::vec3 scale;
 };
 
+enum GeometryUsage {
+  GEOMETRY_USAGE_STATIC,
+  GEOMETRY_USAGE_DYNAMIC,
+  GEOMETRY_USAGE_STREAM,
+};
+
+static const char* GeometryUsageNames[] = {
+  "static",
+  "dynamic",
+  "stream",
+  nullptr
+};
+
+struct GeometryRange {
+  size_t from;
+  size_t to;
+};
+
+struct GeometryInstanceAttribute {
+  GLuint location;
+  GLint components;
+  GLuint divisor;
+  GLuint buffer;
+  GLsizeiptr size;
+};
+
 struct GeometryVertex {
   glm::vec3 position;
   glm::vec3 normal;
@@ -42,12 +73,16 @@ class Geometry {
   public:
     const GLuint id;
     GLuint refs;
-    Geometry();
+    Geometry(const GeometryUsage usage = GEOMETRY_USAGE_STATIC);
     virtual ~Geometry();
     static void gc(Geometry* geometry);
     GeometryBounds getBounds(const glm::mat4& transform);
+    const GeometryBVH* getBVH();
     const GLuint getVersion();
-    void draw(const GLsizei instances = 0);
+    GeometryUsage getUsage();
+    void invalidateIndex(const size_t from, const size_t to);
+    void invalidateVertices(const size_t from, const size_t to);
+    void draw(const GLsizei instances = 0, const std::vector<GeometryInstanceAttribute>* instanceAttributes = nullptr, const GLuint baseInstance = 0);
     std::vector<GeometryCollider> colliders;
     std::vector<GLushort> index;
     std::vector<GeometryVertex> vertices;
@@ -60,10 +95,24 @@ class Geometry {
     virtual void update();
   private:
     static GLuint geometryId;
+    GeometryBVH* bvh;
+    GLuint bvhVersion;
     GLuint count;
     GLuint ebo;
     GLuint vao;
     GLuint vbo;
+    GeometryUsage usage;
+    GeometryRange dirtyIndex;
+    GeometryRange dirtyVertices;
+    size_t indexCapacity;
+    size_t vertexCapacity;
+    GLsync fences[3];
+    GLushort* mappedIndex;
+    GeometryVertex* mappedVertices;
+    GLuint slot;
     static GLfloat getMaxScaleOnAxis(const glm::mat4& transform);
+    void allocate(const size_t numIndices, const size_t numVertices);
+    static void bindInstanceAttribute(const GeometryInstanceAttribute& attribute);
+    static void unbindInstanceAttribute(const GeometryInstanceAttribute& attribute);
     void upload();
 };
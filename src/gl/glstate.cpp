@@ -0,0 +1,269 @@
+#include "glstate.hpp"
+
+GLint GLState::activeTexture = 0;
+GLuint GLState::arrayBuffer = 0;
+bool GLState::blend = false;
+bool GLState::cullFace = false;
+GLenum GLState::cullFaceMode = GL_BACK;
+bool GLState::depthTest = false;
+GLuint GLState::drawFramebuffer = 0;
+GLStateCounters GLState::counters = { 0, 0 };
+GLStateCounters GLState::frameCounters = { 0, 0 };
+GLuint GLState::program = 0;
+GLuint GLState::readFramebuffer = 0;
+GLuint GLState::textures[GLStateTextureUnits][3] = {};
+GLuint GLState::vertexArray = 0;
+GLint GLState::viewport[4] = { 0, 0, 0, 0 };
+
+static const GLenum textureTargets[3] = {
+  GL_TEXTURE_2D,
+  GL_TEXTURE_2D_MULTISAMPLE,
+  GL_TEXTURE_CUBE_MAP
+};
+
+static const GLenum textureTargetBindings[3] = {
+  GL_TEXTURE_BINDING_2D,
+  GL_TEXTURE_BINDING_2D_MULTISAMPLE,
+  GL_TEXTURE_BINDING_CUBE_MAP
+};
+
+void GLState::reset() {
+  // Reads the whole context back once. Anything else touching GL
+  // (ImGui's renderer) restores what it changed, so the shadow stays valid.
+  GLint value;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &value);
+  program = value;
+  blend = glIsEnabled(GL_BLEND);
+  cullFace = glIsEnabled(GL_CULL_FACE);
+  depthTest = glIsEnabled(GL_DEPTH_TEST);
+  glGetIntegerv(GL_CULL_FACE_MODE, &value);
+  cullFaceMode = value;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &value);
+  drawFramebuffer = value;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &value);
+  readFramebuffer = value;
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &value);
+  vertexArray = value;
+  glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &value);
+  arrayBuffer = value;
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &value);
+  activeTexture = value - GL_TEXTURE0;
+  for (GLint unit = 0; unit < GLStateTextureUnits; unit++) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    for (GLint i = 0; i < 3; i++) {
+      glGetIntegerv(textureTargetBindings[i], &value);
+      textures[unit][i] = value;
+    }
+  }
+  glActiveTexture(GL_TEXTURE0 + activeTexture);
+  counters = { 0, 0 };
+  frameCounters = { 0, 0 };
+}
+
+void GLState::nextFrame() {
+  frameCounters = counters;
+  counters = { 0, 0 };
+}
+
+const GLStateCounters& GLState::getCounters() {
+  return frameCounters;
+}
+
+void GLState::useProgram(const GLuint program) {
+  if (isRedundant(GLState::program == program)) {
+    return;
+  }
+  GLState::program = program;
+  glUseProgram(program);
+}
+
+void GLState::setBlend(const bool enabled) {
+  setCapability(GL_BLEND, blend, enabled);
+}
+
+void GLState::setDepthTest(const bool enabled) {
+  setCapability(GL_DEPTH_TEST, depthTest, enabled);
+}
+
+void GLState::setCullFace(const GLenum mode) {
+  if (mode == GL_NONE) {
+    setCapability(GL_CULL_FACE, cullFace, false);
+    return;
+  }
+  setCapability(GL_CULL_FACE, cullFace, true);
+  if (isRedundant(cullFaceMode == mode)) {
+    return;
+  }
+  cullFaceMode = mode;
+  glCullFace(mode);
+}
+
+GLuint GLState::getFramebuffer() {
+  return drawFramebuffer;
+}
+
+void GLState::bindFramebuffer(const GLenum target, const GLuint framebuffer) {
+  const bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+  const bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+  if (isRedundant(
+    (!draw || drawFramebuffer == framebuffer)
+    && (!read || readFramebuffer == framebuffer)
+  )) {
+    return;
+  }
+  if (draw) {
+    drawFramebuffer = framebuffer;
+  }
+  if (read) {
+    readFramebuffer = framebuffer;
+  }
+  glBindFramebuffer(target, framebuffer);
+}
+
+const GLint* GLState::getViewport() {
+  return viewport;
+}
+
+void GLState::setViewport(const GLint x, const GLint y, const GLsizei width, const GLsizei height) {
+  if (isRedundant(
+    viewport[0] == x && viewport[1] == y
+    && viewport[2] == width && viewport[3] == height
+  )) {
+    return;
+  }
+  viewport[0] = x;
+  viewport[1] = y;
+  viewport[2] = width;
+  viewport[3] = height;
+  glViewport(x, y, width, height);
+}
+
+GLuint GLState::getTexture(const GLenum target) {
+  // Only 2D, multisample and cubemap bindings are shadowed
+  const GLint index = getTargetIndex(target);
+  return index != -1 ? textures[activeTexture][index] : 0;
+}
+
+void GLState::bindTexture(const GLenum target, const GLuint texture) {
+  bindTexture(activeTexture, target, texture);
+}
+
+void GLState::bindTexture(const GLint unit, const GLenum target, const GLuint texture) {
+  const GLint index = getTargetIndex(target);
+  if (index != -1 && isRedundant(textures[unit][index] == texture)) {
+    return;
+  }
+  setActiveTexture(unit);
+  if (index == -1) {
+    counters.issued++;
+  } else {
+    textures[unit][index] = texture;
+  }
+  glBindTexture(target, texture);
+}
+
+void GLState::bindVertexArray(const GLuint vao) {
+  if (isRedundant(vertexArray == vao)) {
+    return;
+  }
+  vertexArray = vao;
+  glBindVertexArray(vao);
+}
+
+void GLState::bindBuffer(const GLenum target, const GLuint buffer) {
+  // The element array binding belongs to the bound VAO,
+  // so only the array buffer can be shadowed globally.
+  if (target != GL_ARRAY_BUFFER) {
+    counters.issued++;
+    glBindBuffer(target, buffer);
+    return;
+  }
+  if (isRedundant(arrayBuffer == buffer)) {
+    return;
+  }
+  arrayBuffer = buffer;
+  glBindBuffer(target, buffer);
+}
+
+void GLState::deleteBuffers(const GLsizei count, const GLuint* buffers) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (arrayBuffer == buffers[i]) {
+      arrayBuffer = 0;
+    }
+  }
+  glDeleteBuffers(count, buffers);
+}
+
+void GLState::deleteFramebuffers(const GLsizei count, const GLuint* framebuffers) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (drawFramebuffer == framebuffers[i]) {
+      drawFramebuffer = 0;
+    }
+    if (readFramebuffer == framebuffers[i]) {
+      readFramebuffer = 0;
+    }
+  }
+  glDeleteFramebuffers(count, framebuffers);
+}
+
+void GLState::deleteTextures(const GLsizei count, const GLuint* textures) {
+  // Deleting a texture unbinds it from every unit
+  for (GLsizei i = 0; i < count; i++) {
+    for (GLint unit = 0; unit < GLStateTextureUnits; unit++) {
+      for (GLint index = 0; index < 3; index++) {
+        if (GLState::textures[unit][index] == textures[i]) {
+          GLState::textures[unit][index] = 0;
+        }
+      }
+    }
+  }
+  glDeleteTextures(count, textures);
+}
+
+void GLState::deleteVertexArrays(const GLsizei count, const GLuint* vaos) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (vertexArray == vaos[i]) {
+      vertexArray = 0;
+    }
+  }
+  glDeleteVertexArrays(count, vaos);
+}
+
+void GLState::setActiveTexture(const GLint unit) {
+  if (isRedundant(activeTexture == unit)) {
+    return;
+  }
+  activeTexture = unit;
+  glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void GLState::setCapability(const GLenum capability, bool& current, const bool enabled) {
+  if (isRedundant(current == enabled)) {
+    return;
+  }
+  current = enabled;
+  if (enabled) {
+    glEnable(capability);
+  } else {
+    glDisable(capability);
+  }
+}
+
+GLint GLState::getTargetIndex(const GLenum target) {
+  for (GLint i = 0; i < 3; i++) {
+    if (textureTargets[i] == target) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool GLState::isRedundant(const bool redundant) {
+  if (redundant) {
+    counters.filtered++;
+  } else {
+    counters.issued++;
+  }
+  return redundant;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+static const GLint GLStateTextureUnits = 32;
+
+struct GLStateCounters {
+  GLuint issued;
+  GLuint filtered;
+};
+
+// Shadows the context state so redundant changes never reach the driver
+// and the current bindings can be read back without a glGet round trip.
+// Everything in src/gl that touches program, capability, framebuffer,
+// viewport, texture, vertex array or array buffer state goes through here.
+class GLState {
+  public:
+    static void reset();
+    static void nextFrame();
+    static const GLStateCounters& getCounters();
+    static void useProgram(const GLuint program);
+    static void setBlend(const bool enabled);
+    static void setDepthTest(const bool enabled);
+    static void setCullFace(const GLenum mode);
+    static GLuint getFramebuffer();
+    static void bindFramebuffer(const GLenum target, const GLuint framebuffer);
+    static const GLint* getViewport();
+    static void setViewport(const GLint x, const GLint y, const GLsizei width, const GLsizei height);
+    static GLuint getTexture(const GLenum target);
+    static void bindTexture(const GLenum target, const GLuint texture);
+    static void bindTexture(const GLint unit, const GLenum target, const GLuint texture);
+    static void bindVertexArray(const GLuint vao);
+    static void bindBuffer(const GLenum target, const GLuint buffer);
+    static void deleteBuffers(const GLsizei count, const GLuint* buffers);
+    static void deleteFramebuffers(const GLsizei count, const GLuint* framebuffers);
+    static void deleteTextures(const GLsizei count, const GLuint* textures);
+    static void deleteVertexArrays(const GLsizei count, const GLuint* vaos);
+  private:
+    static GLint activeTexture;
+    static GLuint arrayBuffer;
+    static bool blend;
+    static bool cullFace;
+    static GLenum cullFaceMode;
+    static bool depthTest;
+    static GLuint drawFramebuffer;
+    static GLStateCounters counters;
+    static GLStateCounters frameCounters;
+    static GLuint program;
+    static GLuint readFramebuffer;
+    static GLuint textures[GLStateTextureUnits][3];
+    static GLuint vertexArray;
+    static GLint viewport[4];
+    static void setActiveTexture(const GLint unit);
+    static void setCapability(const GLenum capability, bool& current, const bool enabled);
+    static GLint getTargetIndex(const GLenum target);
+    static bool isRedundant(const bool redundant);
+};
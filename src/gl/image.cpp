@@ -1,55 +1,171 @@
 #include "image.hpp"
+#include "../core/cache.hpp"
+#include <cstring>
 #include <stb_image.h>
 
-Image::Image(const ImageEncoding encoding, HTTPRequest* request):
+// Bytes of pixels all images can upload per frame
+static const GLsizeiptr uploadBudgetPerFrame = 1024 * 1024 * 8;
+
+GLsizeiptr Image::uploadBudget = uploadBudgetPerFrame;
+
+ImageDecoding::~ImageDecoding() {
+  if (request != nullptr) {
+    delete request;
+  }
+}
+
+Image::Image(const ImageEncoding encoding, HTTPRequest* request, Workers* workers, const std::string& url, const bool compress):
   Texture(),
+  compress(compress),
+  decoding(nullptr),
   encoding(encoding),
+  isResident(false),
+  pixelBuffer(0),
   request(request),
-  size(glm::vec2(0, 0))
+  size(glm::vec2(0, 0)),
+  uploadedLevels(0),
+  uploadedRows(0),
+  url(url),
+  workers(workers)
 {
-
+  request->onReady = [this]() {
+    decode();
+  };
 }
 
 Image::~Image() {
   if (request != nullptr) {
     delete request;
   }
+  if (pixelBuffer != 0) {
+    GLState::deleteBuffers(1, &pixelBuffer);
+  }
 }
 
 GLuint Image::get() {
-  if (texture == 0) {
+  if (!isResident) {
     update();
   }
-  return texture;
+  return isResident ? texture : 0;
 }
 
 const glm::vec2& Image::getSize() {
   return size;
 }
 
-void Image::update() {
-  if (request != nullptr && request->isReady) {
-    if (request->response.status >= 200 && request->response.status < 400 && request->response.size > 0) {
-      GLint x, y, n;
-      unsigned char* data = stbi_load_from_memory(request->response.data, request->response.size, &x, &y, &n, 4);
-      if (data != nullptr) {
-        GLint binding;
-        glGetIntegerv(GL_TEXTURE_BINDING_2D, &binding);
-        const GLint format = encoding == IMAGE_ENCONDING_SRGB ? GL_SRGB_ALPHA : GL_RGBA;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, binding);
-        stbi_image_free(data);
-        size = glm::vec2(x, y);
+void Image::nextFrame() {
+  uploadBudget = uploadBudgetPerFrame;
+}
+
+void Image::decode() {
+  // The worker owns the response from here on
+  decoding = std::make_shared<ImageDecoding>();
+  decoding->request = request;
+  request = nullptr;
+  const bool srgb = encoding == IMAGE_ENCONDING_SRGB;
+  std::string key;
+  if (compress) {
+    // The key gets the content hash added by the worker
+    key = url + (srgb ? "\nsrgb" : "\nlinear") + "\nbc1/bc3";
+  }
+  workers->run([decoding = decoding, srgb, key]() {
+    const HTTPResponse& response = decoding->request->response;
+    TextureCodecData& texture = decoding->texture;
+    if (
+      response.status >= 200 && response.status < 400 && response.size > 0
+      // KTX2 and DDS come with their own format and mips
+      && !TextureCodec::load(response.data, response.size, srgb, texture)
+    ) {
+      std::string cacheKey;
+      if (!key.empty()) {
+        cacheKey = Cache::key(Cache::hash(response.data, response.size, Cache::hash(key.data(), key.size())));
+      }
+      if (cacheKey.empty() || !TextureCodec::read(cacheKey, texture)) {
+        GLint width, height, n;
+        unsigned char* pixels = stbi_load_from_memory(response.data, response.size, &width, &height, &n, 4);
+        if (pixels != nullptr) {
+          if (!cacheKey.empty()) {
+            TextureCodec::compress(pixels, width, height, srgb, texture);
+            TextureCodec::write(cacheKey, texture);
+          } else {
+            const size_t size = (size_t) width * height * 4;
+            texture.format = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+            texture.isCompressed = false;
+            texture.levels = { { width, height, 0, size } };
+            texture.pixels.assign(pixels, pixels + size);
+          }
+          stbi_image_free(pixels);
+        }
       }
     }
-    delete request;
-    request = nullptr;
+    delete decoding->request;
+    decoding->request = nullptr;
+    decoding->isDone.store(true, std::memory_order_release);
+  });
+}
+
+void Image::update() {
+  if (decoding == nullptr || !decoding->isDone.load(std::memory_order_acquire)) {
+    return;
+  }
+  const TextureCodecData& data = decoding->texture;
+  if (data.levels.empty()) {
+    decoding = nullptr;
+    return;
+  }
+  const TextureCodecLevel& base = data.levels.front();
+  // Plain RGBA gets its mips generated. Containers and transcoded images bring them.
+  const bool generateMipmaps = !data.isCompressed && data.levels.size() == 1;
+  if (texture == 0) {
+    const GLsizei levels = generateMipmaps ? (GLsizei) glm::floor(glm::log2((GLfloat) glm::max(base.width, base.height))) + 1 : data.levels.size();
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, levels, data.format, base.width, base.height);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glCreateBuffers(1, &pixelBuffer);
+    glNamedBufferStorage(pixelBuffer, data.pixels.size(), nullptr, GL_MAP_WRITE_BIT);
+  }
+  // Every slice goes to its own range of the buffer,
+  // so the writes never wait on the previous copies.
+  while (uploadBudget > 0 && uploadedLevels < data.levels.size()) {
+    const TextureCodecLevel& level = data.levels[uploadedLevels];
+    // Compressed data goes in rows of 4x4 blocks
+    const GLint rowHeight = data.isCompressed ? 4 : 1;
+    const GLint rowCount = (level.height + rowHeight - 1) / rowHeight;
+    const GLsizeiptr rowSize = level.size / rowCount;
+    const GLint rows = glm::min(rowCount - uploadedRows, (GLint) glm::max(uploadBudget / rowSize, (GLsizeiptr) 1));
+    const GLsizeiptr offset = level.offset + rowSize * uploadedRows;
+    const GLsizeiptr slice = rowSize * rows;
+    const GLint y = uploadedRows * rowHeight;
+    const GLsizei height = glm::min(rows * rowHeight, level.height - y);
+    void* mapped = glMapNamedBufferRange(pixelBuffer, offset, slice, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    std::memcpy(mapped, data.pixels.data() + offset, slice);
+    glUnmapNamedBuffer(pixelBuffer);
+    GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    if (data.isCompressed) {
+      glCompressedTextureSubImage2D(texture, uploadedLevels, 0, y, level.width, height, data.format, slice, (void*) offset);
+    } else {
+      glTextureSubImage2D(texture, uploadedLevels, 0, y, level.width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*) offset);
+    }
+    GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    uploadBudget -= slice;
+    uploadedRows += rows;
+    if (uploadedRows == rowCount) {
+      uploadedLevels++;
+      uploadedRows = 0;
+    }
+  }
+  if (uploadedLevels < data.levels.size()) {
+    return;
+  }
+  if (generateMipmaps) {
+    glGenerateTextureMipmap(texture);
   }
+  GLState::deleteBuffers(1, &pixelBuffer);
+  pixelBuffer = 0;
+  size = glm::vec2(base.width, base.height);
+  decoding = nullptr;
+  isResident = true;
 }
@@ -3,23 +3,47 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
 #include "texture.hpp"
+#include "texturecodec.hpp"
 #include "../core/http.hpp"
+#include "../core/workers.hpp"
 
 enum ImageEncoding {
   IMAGE_ENCONDING_SRGB,
   IMAGE_ENCONDING_LINEAR,
 };
 
+// Shared with the worker decoding it, so the image can go away mid-decode
+struct ImageDecoding {
+  std::atomic<bool> isDone = false;
+  HTTPRequest* request = nullptr;
+  TextureCodecData texture = { GL_NONE, false, {}, {} };
+  ~ImageDecoding();
+};
+
 class Image: public Texture {
   public:
-    Image(const ImageEncoding encoding, HTTPRequest* request);
+    Image(const ImageEncoding encoding, HTTPRequest* request, Workers* workers, const std::string& url = "", const bool compress = false);
     ~Image();
     GLuint get();
     const glm::vec2& getSize();
+    static void nextFrame();
   private:
+    const bool compress;
+    std::shared_ptr<ImageDecoding> decoding;
     const ImageEncoding encoding;
+    bool isResident;
+    GLuint pixelBuffer;
     HTTPRequest* request;
     glm::vec2 size;
+    size_t uploadedLevels;
+    GLint uploadedRows;
+    const std::string url;
+    Workers* workers;
+    static GLsizeiptr uploadBudget;
+    void decode();
     void update();
 };
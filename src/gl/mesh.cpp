@@ -1,4 +1,5 @@
 #include "mesh.hpp"
+#include "sceneindex.hpp"
 #include <glm/gtc/matrix_inverse.hpp> 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -16,6 +17,8 @@ Mesh::Mesh(Geometry* geometry, Shader* shader):
   position(glm::vec3(0.0, 0.0, 0.0)),
   rotation(glm::quat(1.0, 0.0, 0.0, 0.0)),
   scale(glm::vec3(1.0, 1.0, 1.0)),
+  sceneIndex(nullptr),
+  sceneProxy(-1),
   shader(shader),
   transform(glm::mat4(1.0))
 {
@@ -23,6 +26,12 @@ Mesh::Mesh(Geometry* geometry, Shader* shader):
 }
 
 Mesh::~Mesh() {
+  for (const auto& attribute : instanceAttributes) {
+    GLState::deleteBuffers(1, &attribute.buffer);
+  }
+  if (sceneIndex != nullptr) {
+    sceneIndex->remove(this);
+  }
   for (const auto& [name, texture]: uniformsTexture) {
     Texture::gc(texture);
   }
@@ -44,10 +53,26 @@ const GeometryBounds& Mesh::getBounds() {
     needsBoundsUpdate = false;
     bounds = geometry->getBounds(transform);
     boundsVersion = geometry->getVersion();
+    if (sceneIndex != nullptr) {
+      sceneIndex->queueUpdate(this);
+    }
   }
   return bounds;
 }
 
+SceneIndex* Mesh::getSceneIndex() {
+  return sceneIndex;
+}
+
+GLint Mesh::getSceneProxy() {
+  return sceneProxy;
+}
+
+void Mesh::setSceneIndex(SceneIndex* index, const GLint proxy) {
+  sceneIndex = index;
+  sceneProxy = proxy;
+}
+
 bool Mesh::getFrustumCulling() {
   return frustumCulling;
 }
@@ -70,7 +95,7 @@ const glm::vec3& Mesh::getPosition() {
 
 void Mesh::setPosition(const glm::vec3& value) {
   position = value;
-  needsTransformUpdate = true;
+  invalidateTransform();
 }
 
 const glm::quat& Mesh::getRotation() {
@@ -79,7 +104,7 @@ const glm::quat& Mesh::getRotation() {
 
 void Mesh::setRotation(const glm::quat& value) {
   rotation = value;
-  needsTransformUpdate = true;
+  invalidateTransform();
 }
 
 const glm::vec3& Mesh::getScale() {
@@ -88,7 +113,7 @@ const glm::vec3& Mesh::getScale() {
 
 void Mesh::setScale(const glm::vec3& value) {
   scale = value;
-  needsTransformUpdate = true;
+  invalidateTransform();
 }
 
 void Mesh::lookAt(const glm::vec3 & target) {
@@ -98,7 +123,7 @@ void Mesh::lookAt(const glm::vec3 & target) {
     up = glm::vec3(0, 0, 1);
   }
   rotation = glm::quatLookAt(direction, up);
-  needsTransformUpdate = true;
+  invalidateTransform();
 }
 
 const glm::mat4& Mesh::getTransform() {
@@ -108,12 +133,50 @@ const glm::mat4& Mesh::getTransform() {
   return transform;
 }
 
+void Mesh::setInstanceAttribute(const GLuint location, const GLint components, const GLuint divisor, const std::vector<GLfloat>& data) {
+  const GLsizeiptr size = sizeof(GLfloat) * data.size();
+  for (auto& attribute : instanceAttributes) {
+    if (attribute.location == location) {
+      attribute.components = components;
+      attribute.divisor = divisor;
+      attribute.size = size;
+      GLState::bindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+      glBufferData(GL_ARRAY_BUFFER, size, data.data(), GL_DYNAMIC_DRAW);
+      GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+      return;
+    }
+  }
+  GeometryInstanceAttribute attribute = { location, components, divisor, 0, size };
+  glGenBuffers(1, &attribute.buffer);
+  GLState::bindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+  glBufferData(GL_ARRAY_BUFFER, size, data.data(), GL_DYNAMIC_DRAW);
+  GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+  instanceAttributes.push_back(attribute);
+}
+
+bool Mesh::updateInstanceAttribute(const GLuint location, const size_t offset, const std::vector<GLfloat>& data) {
+  for (const auto& attribute : instanceAttributes) {
+    if (attribute.location == location) {
+      const GLsizeiptr from = sizeof(GLfloat) * offset;
+      const GLsizeiptr size = sizeof(GLfloat) * data.size();
+      if (from + size > attribute.size) {
+        return false;
+      }
+      GLState::bindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+      glBufferSubData(GL_ARRAY_BUFFER, from, size, data.data());
+      GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+      return true;
+    }
+  }
+  return false;
+}
+
 void Mesh::setUniformInt(const std::string& name, const GLint value) {
-  uniformsInt[name] = value;
+  uniformsInt[name] = { shader != nullptr ? shader->getUniform(name.c_str()) : -1, value };
 }
 
 void Mesh::setUniformFloat(const std::string& name, const GLfloat value) {
-  uniformsFloat[name] = value;
+  uniformsFloat[name] = { shader != nullptr ? shader->getUniform(name.c_str()) : -1, value };
 }
 
 void Mesh::setUniformTexture(const std::string& name, Texture* texture) {
@@ -125,15 +188,22 @@ void Mesh::setUniformTexture(const std::string& name, Texture* texture) {
 }
 
 void Mesh::setUniformVec2(const std::string& name, const glm::vec2& value) {
-  uniformsVec2[name] = value;
+  uniformsVec2[name] = { shader != nullptr ? shader->getUniform(name.c_str()) : -1, value };
 }
 
 void Mesh::setUniformVec3(const std::string& name, const glm::vec3& value) {
-  uniformsVec3[name] = value;
+  uniformsVec3[name] = { shader != nullptr ? shader->getUniform(name.c_str()) : -1, value };
 }
 
 void Mesh::setUniformVec4(const std::string& name, const glm::vec4& value) {
-  uniformsVec4[name] = value;
+  uniformsVec4[name] = { shader != nullptr ? shader->getUniform(name.c_str()) : -1, value };
+}
+
+void Mesh::invalidateTransform() {
+  needsTransformUpdate = true;
+  if (sceneIndex != nullptr) {
+    sceneIndex->queueUpdate(this);
+  }
 }
 
 void Mesh::updateTransform() {
@@ -145,7 +215,7 @@ void Mesh::updateTransform() {
   normalTransform = glm::inverseTranspose(glm::mat3(transform));
 }
 
-void Mesh::render(Camera* camera, const GLsizei instances) {
+void Mesh::render(Camera* camera, Drawbuffer* drawbuffer, const GLsizei instances) {
   if (
     shader == nullptr
     || (
@@ -159,23 +229,68 @@ void Mesh::render(Camera* camera, const GLsizei instances) {
   }
   shader->setCameraUniforms(camera);
   shader->setTextureUniforms(&uniformsTexture);
-  shader->setUniformMat4("modelMatrix", transform);
-  shader->setUniformMat3("normalMatrix", normalTransform);
-  for (const auto& [name, value]: uniformsInt) {
-    shader->setUniformInt(name.c_str(), value);
+  shader->setModelUniforms(drawbuffer, transform, normalTransform);
+  for (const auto& [name, uniform]: uniformsInt) {
+    shader->setUniformInt(uniform.uniform, uniform.value);
+  }
+  for (const auto& [name, uniform]: uniformsFloat) {
+    shader->setUniformFloat(uniform.uniform, uniform.value);
+  }
+  for (const auto& [name, uniform]: uniformsVec2) {
+    shader->setUniformVec2(uniform.uniform, uniform.value);
+  }
+  for (const auto& [name, uniform]: uniformsVec3) {
+    shader->setUniformVec3(uniform.uniform, uniform.value);
+  }
+  for (const auto& [name, uniform]: uniformsVec4) {
+    shader->setUniformVec4(uniform.uniform, uniform.value);
+  }
+  if (!shader->use()) {
+    return;
+  }
+  geometry->draw(instances, instanceAttributes.empty() ? nullptr : &instanceAttributes);
+}
+
+void Mesh::enqueue(Camera* camera, RenderQueue* queue, const GLsizei instances) {
+  if (
+    shader == nullptr
+    || (
+      frustumCulling && !camera->isInFrustum(getBounds())
+    )
+  ) {
+    return;
+  }
+  if (needsTransformUpdate) {
+    updateTransform();
+  }
+  // Everything the script can still change gets copied,
+  // so the draw looks the same as if it was issued right away.
+  RenderQueueCommand command = {
+    geometry,
+    shader,
+    instanceAttributes.empty() ? nullptr : &instanceAttributes,
+    instances,
+    transform,
+    normalTransform,
+    glm::distance(camera->getPosition(), getBounds().position),
+    uniformsTexture,
+    0,
+    {}
+  };
+  for (const auto& [name, uniform]: uniformsInt) {
+    command.uniforms.push_back({ uniform.uniform, RENDER_QUEUE_UNIFORM_INT, uniform.value, {} });
   }
-  for (const auto& [name, value]: uniformsFloat) {
-    shader->setUniformFloat(name.c_str(), value);
+  for (const auto& [name, uniform]: uniformsFloat) {
+    command.uniforms.push_back({ uniform.uniform, RENDER_QUEUE_UNIFORM_FLOAT, 0, { uniform.value } });
   }
-  for (const auto& [name, value]: uniformsVec2) {
-    shader->setUniformVec2(name.c_str(), value);
+  for (const auto& [name, uniform]: uniformsVec2) {
+    command.uniforms.push_back({ uniform.uniform, RENDER_QUEUE_UNIFORM_VEC2, 0, { uniform.value.x, uniform.value.y } });
   }
-  for (const auto& [name, value]: uniformsVec3) {
-    shader->setUniformVec3(name.c_str(), value);
+  for (const auto& [name, uniform]: uniformsVec3) {
+    command.uniforms.push_back({ uniform.uniform, RENDER_QUEUE_UNIFORM_VEC3, 0, { uniform.value.x, uniform.value.y, uniform.value.z } });
   }
-  for (const auto& [name, value]: uniformsVec4) {
-    shader->setUniformVec4(name.c_str(), value);
+  for (const auto& [name, uniform]: uniformsVec4) {
+    command.uniforms.push_back({ uniform.uniform, RENDER_QUEUE_UNIFORM_VEC4, 0, { uniform.value.x, uniform.value.y, uniform.value.z, uniform.value.w } });
   }
-  shader->use();
-  geometry->draw(instances);
+  queue->push(std::move(command));
 }
@@ -8,9 +8,18 @@
 #include "camera.hpp"
 #include "geometry.hpp"
 #include "object.hpp"
+#include "renderqueue.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
 
+class SceneIndex;
+
+template <typename T>
+struct MeshUniform {
+  GLint uniform;
+  T value;
+};
+
 class Mesh: public Object {
   public:
     Mesh(Geometry* geometry, Shader* shader);
@@ -18,6 +27,9 @@ class Mesh: public Object {
     btRigidBody* getBody();
     void setBody(btRigidBody* value);
     const GeometryBounds& getBounds();
+    SceneIndex* getSceneIndex();
+    GLint getSceneProxy();
+    void setSceneIndex(SceneIndex* index, const GLint proxy);
     bool getFrustumCulling();
     void setFrustumCulling(const bool enabled);
     Geometry* getGeometry();
@@ -30,32 +42,39 @@ class Mesh: public Object {
     void setScale(const glm::vec3& value);
     void lookAt(const glm::vec3 & target);
     const glm::mat4& getTransform();
+    void setInstanceAttribute(const GLuint location, const GLint components, const GLuint divisor, const std::vector<GLfloat>& data);
+    bool updateInstanceAttribute(const GLuint location, const size_t offset, const std::vector<GLfloat>& data);
     void setUniformInt(const std::string& name, const GLint value);
     void setUniformFloat(const std::string& name, const GLfloat value);
     void setUniformTexture(const std::string& name, Texture* texture);
     void setUniformVec2(const std::string& name, const glm::vec2& value);
     void setUniformVec3(const std::string& name, const glm::vec3& value);
     void setUniformVec4(const std::string& name, const glm::vec4& value);
-    void render(Camera* camera, const GLsizei instances = 0);
+    void render(Camera* camera, Drawbuffer* drawbuffer, const GLsizei instances = 0);
+    void enqueue(Camera* camera, RenderQueue* queue, const GLsizei instances = 0);
   private:
     btRigidBody* body;
     GeometryBounds bounds;
     GLuint boundsVersion;
     bool frustumCulling;
     Geometry* geometry;
+    std::vector<GeometryInstanceAttribute> instanceAttributes;
     Shader* shader;
     glm::vec3 position;
     glm::quat rotation;
     glm::vec3 scale;
+    SceneIndex* sceneIndex;
+    GLint sceneProxy;
     glm::mat4 transform;
     glm::mat3 normalTransform;
     bool needsBoundsUpdate;
     bool needsTransformUpdate;
     std::map<std::string, Texture*> uniformsTexture;
-    std::map<std::string, GLint> uniformsInt;
-    std::map<std::string, GLfloat> uniformsFloat;
-    std::map<std::string, glm::vec2> uniformsVec2;
-    std::map<std::string, glm::vec3> uniformsVec3;
-    std::map<std::string, glm::vec4> uniformsVec4;
+    std::map<std::string, MeshUniform<GLint>> uniformsInt;
+    std::map<std::string, MeshUniform<GLfloat>> uniformsFloat;
+    std::map<std::string, MeshUniform<glm::vec2>> uniformsVec2;
+    std::map<std::string, MeshUniform<glm::vec3>> uniformsVec3;
+    std::map<std::string, MeshUniform<glm::vec4>> uniformsVec4;
+    void invalidateTransform();
     void updateTransform();
 };
@@ -1,4 +1,24 @@
 #include "raycaster.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+// Packets are handed out in chunks this size
+static const size_t packetsPerChunk = 16;
+// Jobs queued on the workers to help the calling thread
+static const size_t maxHelpers = 4;
+
+// Outlives the batch if a helper only starts after all the chunks were taken
+struct RaycasterBatch {
+  std::atomic<size_t> next = 0;
+  std::atomic<size_t> completed = 0;
+  size_t chunks = 0;
+  std::condition_variable condition;
+  std::mutex mutex;
+};
 
 Raycaster::Raycaster() {
 
@@ -11,59 +31,144 @@ void Raycaster::init() {
 }
 
 void Raycaster::intersect(const GLuint id, const GeometryBounds& bounds, Geometry* geometry, const glm::mat4& transform) {
-  if (!geometry->isValid || !intersectsBounds(bounds)) {
+  if (
+    !geometry->isValid
+    || ray.direction == glm::vec3(0.0)
+    || !intersectsBounds(bounds, ray.origin, ray.direction)
+  ) {
     return;
   }
-  for (size_t i = 0, l = geometry->index.size(); i < l; i += 3) {
-    glm::vec3 a = transformVector(geometry->vertices.at(geometry->index.at(i)).position, transform);
-    glm::vec3 b = transformVector(geometry->vertices.at(geometry->index.at(i + 1)).position, transform);
-    glm::vec3 c = transformVector(geometry->vertices.at(geometry->index.at(i + 2)).position, transform);
-    GLfloat d = intersectTriangle(a, b, c);
-    if (d != 0.0 && result.distance > d) {
-      result.id = id;
-      result.distance = d;
-      result.normal = glm::normalize(glm::cross(c - b, a - b));
-      result.position = ray.origin + ray.direction * d;
-    }
+  const GeometryBVH* bvh = geometry->getBVH();
+  // Move the ray into object space once instead of transforming every vertex.
+  // The transform is affine, so distances along the ray are preserved.
+  const glm::mat4 inverse = glm::inverse(transform);
+  const glm::vec3 origin = transformVector(ray.origin, inverse);
+  const glm::vec3 direction = glm::mat3(inverse) * ray.direction;
+  const bool isFlipped = glm::determinant(glm::mat3(transform)) < 0.0;
+  GLfloat distance = result.distance;
+  glm::vec3 normal;
+  if (!bvh->intersect(origin, direction, isFlipped, distance, normal)) {
+    return;
   }
+  result.id = id;
+  result.distance = distance;
+  result.normal = glm::normalize(glm::transpose(glm::mat3(inverse)) * normal);
+  result.position = ray.origin + ray.direction * distance;
 }
 
 void Raycaster::setFromCamera(Camera* camera, const glm::vec2& position) {
   ray.origin = camera->getPosition();
   ray.direction = transformVector(glm::vec3(position.x, position.y, 0.5), glm::inverse(camera->getProjection() * camera->getView()));
-  ray.direction = glm::normalize(ray.direction - ray.origin);
+  // A degenerate ray keeps a zero direction, which never hits anything
+  const glm::vec3 direction = ray.direction - ray.origin;
+  const GLfloat length = glm::length(direction);
+  ray.direction = length > 0.0 ? direction / length : glm::vec3(0.0);
 }
 
-bool Raycaster::intersectsBounds(const GeometryBounds &bounds) {
+void Raycaster::intersectBatch(const std::vector<RaycasterRay>& rays, const std::vector<RaycasterTarget>& targets, std::vector<RaycasterHit>& hits, Workers* workers) {
+  hits.assign(rays.size(), RaycasterHit{ 0, std::numeric_limits<GLfloat>::max(), glm::vec3(0.0), glm::vec3(0.0) });
+  if (rays.empty() || targets.empty()) {
+    return;
+  }
+  // Everything that only depends on the target gets computed once for all rays
+  std::vector<BatchTarget> batchTargets;
+  batchTargets.reserve(targets.size());
+  for (const auto& target : targets) {
+    const glm::mat4 inverse = glm::inverse(target.transform);
+    batchTargets.push_back({
+      &target,
+      inverse,
+      glm::transpose(glm::mat3(inverse)),
+      glm::determinant(glm::mat3(target.transform)) < 0.0,
+    });
+  }
+  const size_t packets = (rays.size() + GeometryBVHPacketSize - 1) / GeometryBVHPacketSize;
+  const size_t chunks = (packets + packetsPerChunk - 1) / packetsPerChunk;
+  if (chunks == 1 || workers == nullptr) {
+    intersectPackets(rays, batchTargets, hits, 0, packets);
+    return;
+  }
+  // The calling thread takes chunks too, so a batch never waits behind
+  // whatever else the workers are busy with. Each chunk writes to its own
+  // range of hits, so there's nothing to lock.
+  std::shared_ptr<RaycasterBatch> batch = std::make_shared<RaycasterBatch>();
+  batch->chunks = chunks;
+  const auto trace = [batch, &rays, &batchTargets, &hits, packets]() {
+    size_t chunk;
+    while ((chunk = batch->next.fetch_add(1)) < batch->chunks) {
+      const size_t from = chunk * packetsPerChunk;
+      intersectPackets(rays, batchTargets, hits, from, std::min(from + packetsPerChunk, packets));
+      if (batch->completed.fetch_add(1) + 1 == batch->chunks) {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        batch->condition.notify_all();
+      }
+    }
+  };
+  for (size_t i = 0, l = std::min(chunks - 1, maxHelpers); i < l; i++) {
+    workers->run(trace);
+  }
+  trace();
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->condition.wait(lock, [&batch]() { return batch->completed.load() == batch->chunks; });
+}
+
+void Raycaster::intersectPackets(const std::vector<RaycasterRay>& rays, const std::vector<BatchTarget>& targets, std::vector<RaycasterHit>& hits, const size_t from, const size_t to) {
+  const size_t count = rays.size();
+  glm::vec3 origins[GeometryBVHPacketSize];
+  glm::vec3 directions[GeometryBVHPacketSize];
+  GLfloat distances[GeometryBVHPacketSize];
+  glm::vec3 normals[GeometryBVHPacketSize];
+  for (size_t packet = from; packet < to; packet++) {
+    const size_t first = packet * GeometryBVHPacketSize;
+    for (const auto& batchTarget : targets) {
+      const RaycasterTarget& target = *batchTarget.target;
+      GLuint mask = 0;
+      for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+        const size_t i = first + r;
+        if (i >= count) {
+          origins[r] = directions[r] = glm::vec3(0.0);
+          continue;
+        }
+        const RaycasterRay& ray = rays[i];
+        if (ray.direction != glm::vec3(0.0) && intersectsBounds(target.bounds, ray.origin, ray.direction)) {
+          mask |= 1 << r;
+        }
+        origins[r] = glm::vec3(batchTarget.inverse * glm::vec4(ray.origin, 1.0));
+        directions[r] = glm::mat3(batchTarget.inverse) * ray.direction;
+        distances[r] = hits[i].distance;
+      }
+      if (mask == 0) {
+        continue;
+      }
+      const GLuint hit = target.bvh->intersectPacket(origins, directions, mask, batchTarget.isFlipped, distances, normals);
+      for (GLuint r = 0; r < GeometryBVHPacketSize; r++) {
+        if (hit & (1 << r)) {
+          const RaycasterRay& ray = rays[first + r];
+          RaycasterHit& result = hits[first + r];
+          result.id = target.id;
+          result.distance = distances[r];
+          result.normal = glm::normalize(batchTarget.normalTransform * normals[r]);
+          result.position = ray.origin + ray.direction * distances[r];
+        }
+      }
+    }
+  }
+}
+
+bool Raycaster::intersectsBounds(const GeometryBounds &bounds, const glm::vec3& origin, const glm::vec3& direction) {
   GLfloat distance;
-  GLfloat directionDistance = glm::dot(bounds.position - ray.origin, ray.direction);
+  GLfloat directionDistance = glm::dot(bounds.position - origin, direction);
   if (directionDistance < 0) {
-    distance = glm::distance(ray.origin, bounds.position);
+    distance = glm::distance(origin, bounds.position);
   } else {
     distance = glm::distance(
-      (ray.direction * directionDistance) + ray.origin,
+      (direction * directionDistance) + origin,
       bounds.position
     );
   }
   return distance <= bounds.radius;
 }
 
-GLfloat Raycaster::intersectTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
-  const glm::vec3 edge1 = b - a;
-  const glm::vec3 edge2 = c - a;
-  const glm::vec3 normal = glm::cross(edge1, edge2);
-  const GLfloat DdN = -glm::dot(ray.direction, normal);
-  if (DdN <= 0.0) return 0.0;
-  const glm::vec3 diff = ray.origin - a;
-  const GLfloat DdQxE2 = -glm::dot(ray.direction, glm::cross(diff, edge2));
-  if (DdQxE2 < 0.0) return 0.0;
-  const GLfloat DdE1xQ = -glm::dot(ray.direction, glm::cross(edge1, diff));
-  if (DdE1xQ < 0.0 || (DdQxE2 + DdE1xQ) > DdN) return 0.0;
-  const GLfloat QdN = glm::dot(diff, normal);
-  if (QdN < 0.0) return 0.0;
-  return QdN / DdN;
-}
-
 glm::vec3 Raycaster::transformVector(const glm::vec3& vector, const glm::mat4& matrix) {
   glm::vec4 transformed = matrix * glm::vec4(vector.x, vector.y, vector.z, 1.0);
   return glm::vec3(transformed.x, transformed.y, transformed.z) / transformed.w;
@@ -3,8 +3,30 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include "../core/workers.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
 #include "geometry.hpp"
+#include <vector>
+
+struct RaycasterRay {
+  glm::vec3 origin;
+  glm::vec3 direction;
+};
+
+struct RaycasterHit {
+  GLuint id;
+  GLfloat distance;
+  glm::vec3 normal;
+  glm::vec3 position;
+};
+
+struct RaycasterTarget {
+  GLuint id;
+  GeometryBounds bounds;
+  const GeometryBVH* bvh;
+  glm::mat4 transform;
+};
 
 class Raycaster {
   public:
@@ -22,8 +44,15 @@ class Raycaster {
     void init();
     void intersect(const GLuint id, const GeometryBounds& bounds, Geometry* geometry, const glm::mat4& transform);
     void setFromCamera(Camera* camera, const glm::vec2& position);
+    static void intersectBatch(const std::vector<RaycasterRay>& rays, const std::vector<RaycasterTarget>& targets, std::vector<RaycasterHit>& hits, Workers* workers);
   private:
-    bool intersectsBounds(const GeometryBounds &bounds);
-    GLfloat intersectTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+    struct BatchTarget {
+      const RaycasterTarget* target;
+      glm::mat4 inverse;
+      glm::mat3 normalTransform;
+      bool isFlipped;
+    };
+    static void intersectPackets(const std::vector<RaycasterRay>& rays, const std::vector<BatchTarget>& targets, std::vector<RaycasterHit>& hits, const size_t from, const size_t to);
+    static bool intersectsBounds(const GeometryBounds &bounds, const glm::vec3& origin, const glm::vec3& direction);
     static glm::vec3 transformVector(const glm::vec3& vector, const glm::mat4& matrix);
 };
@@ -0,0 +1,161 @@
+#include "renderqueue.hpp"
+#include <algorithm>
+#include <cstring>
+
+RenderQueue::RenderQueue(Camera* camera, Drawbuffer* drawbuffer):
+  camera(camera),
+  drawbuffer(drawbuffer),
+  enabled(false)
+{
+
+}
+
+RenderQueue::~RenderQueue() {
+  release();
+}
+
+bool RenderQueue::isEnabled() {
+  return enabled;
+}
+
+void RenderQueue::setEnabled(const bool enabled) {
+  if (!enabled) {
+    flush();
+  }
+  this->enabled = enabled;
+}
+
+void RenderQueue::push(RenderQueueCommand&& command) {
+  // The textures are held until the flush, since a mesh can swap them
+  // (and drop the last reference) after recording the draw.
+  GLuint key = 2166136261;
+  for (const auto& [name, texture]: command.textures) {
+    texture->refs++;
+    key = (key ^ texture->id) * 16777619;
+  }
+  command.texturesKey = key;
+  commands.push_back(std::move(command));
+}
+
+void RenderQueue::flush() {
+  if (commands.empty()) {
+    return;
+  }
+  sorted.clear();
+  for (auto& command : commands) {
+    sorted.push_back(&command);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), compare);
+  for (size_t i = 0, l = sorted.size(); i < l;) {
+    RenderQueueCommand* command = sorted.at(i);
+    size_t run = 1;
+    while (i + run < l && canMerge(command, sorted.at(i + run))) {
+      run++;
+    }
+    Shader* shader = command->shader;
+    shader->setCameraUniforms(camera);
+    shader->setTextureUniforms(&command->textures);
+    setUniforms(command);
+    if (run > 1) {
+      GLfloat* entries = drawbuffer->bind(run);
+      for (size_t j = 0; j < run; j++) {
+        const RenderQueueCommand* instance = sorted.at(i + j);
+        Drawbuffer::write(entries, j, instance->transform, instance->normalTransform);
+      }
+      if (shader->use()) {
+        command->geometry->draw(run, nullptr, 1);
+      }
+    } else {
+      shader->setModelUniforms(drawbuffer, command->transform, command->normalTransform);
+      if (shader->use()) {
+        command->geometry->draw(command->instances, command->instanceAttributes);
+      }
+    }
+    i += run;
+  }
+  release();
+}
+
+void RenderQueue::release() {
+  for (const auto& command : commands) {
+    for (const auto& [name, texture]: command.textures) {
+      Texture::gc(texture);
+    }
+  }
+  commands.clear();
+  sorted.clear();
+}
+
+bool RenderQueue::canMerge(const RenderQueueCommand* a, const RenderQueueCommand* b) {
+  // Only "buffer" shaders can read per-instance transforms
+  if (
+    a->shader != b->shader
+    || a->geometry != b->geometry
+    || a->shader->getTransforms() != SHADER_TRANSFORMS_BUFFER
+    || a->instances != 0 || b->instances != 0
+    || a->instanceAttributes != nullptr || b->instanceAttributes != nullptr
+    || a->texturesKey != b->texturesKey
+    || a->textures != b->textures
+    || a->uniforms.size() != b->uniforms.size()
+  ) {
+    return false;
+  }
+  for (size_t i = 0, l = a->uniforms.size(); i < l; i++) {
+    const RenderQueueUniform& ua = a->uniforms.at(i);
+    const RenderQueueUniform& ub = b->uniforms.at(i);
+    if (
+      ua.uniform != ub.uniform
+      || ua.type != ub.type
+      || ua.intValue != ub.intValue
+      || std::memcmp(ua.value, ub.value, sizeof(ua.value)) != 0
+    ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RenderQueue::compare(const RenderQueueCommand* a, const RenderQueueCommand* b) {
+  const bool blendA = a->shader->getBlend();
+  const bool blendB = b->shader->getBlend();
+  if (blendA != blendB) {
+    return !blendA;
+  }
+  if (blendA) {
+    return a->depth > b->depth;
+  }
+  if (a->shader->id != b->shader->id) {
+    return a->shader->id < b->shader->id;
+  }
+  if (a->texturesKey != b->texturesKey) {
+    return a->texturesKey < b->texturesKey;
+  }
+  if (a->geometry->id != b->geometry->id) {
+    return a->geometry->id < b->geometry->id;
+  }
+  return a->depth < b->depth;
+}
+
+void RenderQueue::setUniforms(const RenderQueueCommand* command) {
+  Shader* shader = command->shader;
+  for (const auto& uniform : command->uniforms) {
+    const GLfloat* v = uniform.value;
+    switch (uniform.type) {
+      case RENDER_QUEUE_UNIFORM_INT:
+        shader->setUniformInt(uniform.uniform, uniform.intValue);
+        break;
+      case RENDER_QUEUE_UNIFORM_FLOAT:
+        shader->setUniformFloat(uniform.uniform, v[0]);
+        break;
+      case RENDER_QUEUE_UNIFORM_VEC2:
+        shader->setUniformVec2(uniform.uniform, glm::vec2(v[0], v[1]));
+        break;
+      case RENDER_QUEUE_UNIFORM_VEC3:
+        shader->setUniformVec3(uniform.uniform, glm::vec3(v[0], v[1], v[2]));
+        break;
+      case RENDER_QUEUE_UNIFORM_VEC4:
+        shader->setUniformVec4(uniform.uniform, glm::vec4(v[0], v[1], v[2], v[3]));
+        break;
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include "camera.hpp"
+#include "drawbuffer.hpp"
+#include "geometry.hpp"
+#include "shader.hpp"
+#include "texture.hpp"
+
+enum RenderQueueUniformType {
+  RENDER_QUEUE_UNIFORM_INT,
+  RENDER_QUEUE_UNIFORM_FLOAT,
+  RENDER_QUEUE_UNIFORM_VEC2,
+  RENDER_QUEUE_UNIFORM_VEC3,
+  RENDER_QUEUE_UNIFORM_VEC4
+};
+
+// Ints keep their own field, so ids and bitmasks above 2^24 survive the queue
+struct RenderQueueUniform {
+  GLint uniform;
+  RenderQueueUniformType type;
+  GLint intValue;
+  GLfloat value[4];
+};
+
+struct RenderQueueCommand {
+  Geometry* geometry;
+  Shader* shader;
+  const std::vector<GeometryInstanceAttribute>* instanceAttributes;
+  GLsizei instances;
+  glm::mat4 transform;
+  glm::mat3 normalTransform;
+  GLfloat depth;
+  std::map<std::string, Texture*> textures;
+  GLuint texturesKey;
+  std::vector<RenderQueueUniform> uniforms;
+};
+
+// Records the draws of a frame instead of issuing them in script order.
+// On flush they get sorted by shader, textures and geometry (opaque ones
+// front-to-back, blended ones back-to-front after them) and runs of identical
+// draws on "buffer" shaders get merged into a single instanced draw.
+// Whatever the commands point at has to outlive them: the VM flushes
+// before anything they reference gets modified or freed.
+class RenderQueue {
+  public:
+    RenderQueue(Camera* camera, Drawbuffer* drawbuffer);
+    ~RenderQueue();
+    bool isEnabled();
+    void setEnabled(const bool enabled);
+    void push(RenderQueueCommand&& command);
+    void flush();
+  private:
+    Camera* camera;
+    std::vector<RenderQueueCommand> commands;
+    Drawbuffer* drawbuffer;
+    bool enabled;
+    std::vector<RenderQueueCommand*> sorted;
+    void release();
+    static bool canMerge(const RenderQueueCommand* a, const RenderQueueCommand* b);
+    static bool compare(const RenderQueueCommand* a, const RenderQueueCommand* b);
+    static void setUniforms(const RenderQueueCommand* command);
+};
@@ -0,0 +1,378 @@
+#include "sceneindex.hpp"
+#include "mesh.hpp"
+#include <algorithm>
+#include <limits>
+
+// Leaves are inflated so small movements don't need to touch the tree
+static const GLfloat margin = 0.1;
+
+SceneIndex::SceneIndex():
+  freeList(-1),
+  root(-1)
+{
+
+}
+
+SceneIndex::~SceneIndex() {
+  for (const auto& node : nodes) {
+    if (node.mesh != nullptr) {
+      node.mesh->setSceneIndex(nullptr, -1);
+    }
+  }
+}
+
+void SceneIndex::add(Mesh* mesh) {
+  if (mesh->getSceneIndex() != nullptr) {
+    return;
+  }
+  const GLint leaf = allocateNode();
+  nodes[leaf].mesh = mesh;
+  refit(leaf);
+  insertLeaf(leaf);
+  mesh->setSceneIndex(this, leaf);
+}
+
+void SceneIndex::remove(Mesh* mesh) {
+  if (mesh->getSceneIndex() != this) {
+    return;
+  }
+  const GLint leaf = mesh->getSceneProxy();
+  if (nodes[leaf].isDirty) {
+    std::erase(dirty, leaf);
+  }
+  removeLeaf(leaf);
+  freeNode(leaf);
+  mesh->setSceneIndex(nullptr, -1);
+}
+
+void SceneIndex::queueUpdate(Mesh* mesh) {
+  Node& node = nodes[mesh->getSceneProxy()];
+  if (!node.isDirty) {
+    node.isDirty = true;
+    dirty.push_back(mesh->getSceneProxy());
+  }
+}
+
+void SceneIndex::intersect(Raycaster* raycaster) {
+  update();
+  if (root == -1) {
+    return;
+  }
+  const glm::vec3& origin = raycaster->ray.origin;
+  const glm::vec3 inverse = (GLfloat) 1.0 / raycaster->ray.direction;
+  std::vector<GLint> stack = { root };
+  while (!stack.empty()) {
+    const GLint index = stack.back();
+    stack.pop_back();
+    const Node& node = nodes[index];
+    const glm::vec3 t1 = (node.min - origin) * inverse;
+    const glm::vec3 t2 = (node.max - origin) * inverse;
+    const glm::vec3 tmin = glm::min(t1, t2);
+    const glm::vec3 tmax = glm::max(t1, t2);
+    const GLfloat enter = glm::max(glm::max(tmin.x, tmin.y), tmin.z);
+    const GLfloat leave = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+    if (leave < enter || leave < 0.0 || enter > raycaster->result.distance) {
+      continue;
+    }
+    if (node.mesh != nullptr) {
+      Mesh* mesh = node.mesh;
+      raycaster->intersect(mesh->getId(), mesh->getBounds(), mesh->getGeometry(), mesh->getTransform());
+      continue;
+    }
+    stack.push_back(node.left);
+    stack.push_back(node.right);
+  }
+}
+
+void SceneIndex::getInFrustum(Camera* camera, std::vector<Mesh*>& meshes) {
+  update();
+  if (root == -1) {
+    return;
+  }
+  std::vector<GLint> stack = { root };
+  while (!stack.empty()) {
+    const Node& node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.mesh != nullptr) {
+      if (camera->isInFrustum(node.mesh->getBounds())) {
+        meshes.push_back(node.mesh);
+      }
+      continue;
+    }
+    const glm::vec3 center = (node.min + node.max) * (GLfloat) 0.5;
+    if (!camera->isInFrustum({ center, glm::length(node.max - center) })) {
+      continue;
+    }
+    stack.push_back(node.left);
+    stack.push_back(node.right);
+  }
+}
+
+void SceneIndex::getInRadius(const glm::vec3& center, const GLfloat radius, std::vector<Mesh*>& meshes) {
+  update();
+  if (root == -1) {
+    return;
+  }
+  std::vector<GLint> stack = { root };
+  while (!stack.empty()) {
+    const Node& node = nodes[stack.back()];
+    stack.pop_back();
+    if (glm::distance(glm::clamp(center, node.min, node.max), center) > radius) {
+      continue;
+    }
+    if (node.mesh != nullptr) {
+      const GeometryBounds& bounds = node.mesh->getBounds();
+      if (glm::distance(bounds.position, center) <= radius + bounds.radius) {
+        meshes.push_back(node.mesh);
+      }
+      continue;
+    }
+    stack.push_back(node.left);
+    stack.push_back(node.right);
+  }
+}
+
+GLint SceneIndex::allocateNode() {
+  GLint index;
+  if (freeList != -1) {
+    index = freeList;
+    freeList = nodes[index].parent;
+  } else {
+    index = nodes.size();
+    nodes.emplace_back();
+  }
+  nodes[index] = { glm::vec3(0.0), glm::vec3(0.0), -1, -1, -1, 0, nullptr, 0, false };
+  return index;
+}
+
+void SceneIndex::freeNode(const GLint index) {
+  nodes[index].mesh = nullptr;
+  nodes[index].isDirty = false;
+  nodes[index].height = -1;
+  nodes[index].parent = freeList;
+  freeList = index;
+}
+
+void SceneIndex::insertLeaf(const GLint leaf) {
+  if (root == -1) {
+    root = leaf;
+    nodes[leaf].parent = -1;
+    return;
+  }
+
+  // Walk down picking the sibling with the cheapest surface area cost
+  const glm::vec3 leafMin = nodes[leaf].min;
+  const glm::vec3 leafMax = nodes[leaf].max;
+  GLint index = root;
+  while (nodes[index].mesh == nullptr) {
+    const Node& node = nodes[index];
+    const GLfloat area = getArea(node.min, node.max);
+    const GLfloat combinedArea = getArea(glm::min(node.min, leafMin), glm::max(node.max, leafMax));
+    const GLfloat cost = 2.0 * combinedArea;
+    const GLfloat inheritance = 2.0 * (combinedArea - area);
+    GLfloat childCost[2];
+    const GLint children[2] = { node.left, node.right };
+    for (GLint i = 0; i < 2; i++) {
+      const Node& child = nodes[children[i]];
+      const GLfloat childArea = getArea(glm::min(child.min, leafMin), glm::max(child.max, leafMax));
+      childCost[i] = (child.mesh != nullptr ? childArea : childArea - getArea(child.min, child.max)) + inheritance;
+    }
+    if (cost < childCost[0] && cost < childCost[1]) {
+      break;
+    }
+    index = childCost[0] < childCost[1] ? node.left : node.right;
+  }
+
+  const GLint sibling = index;
+  const GLint oldParent = nodes[sibling].parent;
+  const GLint newParent = allocateNode();
+  nodes[newParent].parent = oldParent;
+  nodes[newParent].left = sibling;
+  nodes[newParent].right = leaf;
+  nodes[newParent].min = glm::min(nodes[sibling].min, leafMin);
+  nodes[newParent].max = glm::max(nodes[sibling].max, leafMax);
+  nodes[newParent].height = nodes[sibling].height + 1;
+  if (oldParent != -1) {
+    if (nodes[oldParent].left == sibling) {
+      nodes[oldParent].left = newParent;
+    } else {
+      nodes[oldParent].right = newParent;
+    }
+  } else {
+    root = newParent;
+  }
+  nodes[sibling].parent = newParent;
+  nodes[leaf].parent = newParent;
+
+  index = nodes[leaf].parent;
+  while (index != -1) {
+    index = balance(index);
+    Node& node = nodes[index];
+    node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+    node.min = glm::min(nodes[node.left].min, nodes[node.right].min);
+    node.max = glm::max(nodes[node.left].max, nodes[node.right].max);
+    index = node.parent;
+  }
+}
+
+void SceneIndex::removeLeaf(const GLint leaf) {
+  if (leaf == root) {
+    root = -1;
+    return;
+  }
+  const GLint parent = nodes[leaf].parent;
+  const GLint grandParent = nodes[parent].parent;
+  const GLint sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+  freeNode(parent);
+  if (grandParent == -1) {
+    root = sibling;
+    nodes[sibling].parent = -1;
+    return;
+  }
+  if (nodes[grandParent].left == parent) {
+    nodes[grandParent].left = sibling;
+  } else {
+    nodes[grandParent].right = sibling;
+  }
+  nodes[sibling].parent = grandParent;
+  GLint index = grandParent;
+  while (index != -1) {
+    index = balance(index);
+    Node& node = nodes[index];
+    node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+    node.min = glm::min(nodes[node.left].min, nodes[node.right].min);
+    node.max = glm::max(nodes[node.left].max, nodes[node.right].max);
+    index = node.parent;
+  }
+}
+
+GLint SceneIndex::balance(const GLint a) {
+  Node& A = nodes[a];
+  if (A.mesh != nullptr || A.height < 2) {
+    return a;
+  }
+  const GLint b = A.left;
+  const GLint c = A.right;
+  Node& B = nodes[b];
+  Node& C = nodes[c];
+  const GLint difference = C.height - B.height;
+
+  if (difference > 1) {
+    // Rotate C up
+    const GLint f = C.left;
+    const GLint g = C.right;
+    Node& F = nodes[f];
+    Node& G = nodes[g];
+    C.left = a;
+    C.parent = A.parent;
+    A.parent = c;
+    if (C.parent != -1) {
+      if (nodes[C.parent].left == a) {
+        nodes[C.parent].left = c;
+      } else {
+        nodes[C.parent].right = c;
+      }
+    } else {
+      root = c;
+    }
+    const bool keepF = F.height > G.height;
+    const GLint kept = keepF ? f : g;
+    const GLint moved = keepF ? g : f;
+    C.right = kept;
+    A.right = moved;
+    nodes[moved].parent = a;
+    A.min = glm::min(B.min, nodes[moved].min);
+    A.max = glm::max(B.max, nodes[moved].max);
+    C.min = glm::min(A.min, nodes[kept].min);
+    C.max = glm::max(A.max, nodes[kept].max);
+    A.height = 1 + std::max(B.height, nodes[moved].height);
+    C.height = 1 + std::max(A.height, nodes[kept].height);
+    return c;
+  }
+
+  if (difference < -1) {
+    // Rotate B up
+    const GLint d = B.left;
+    const GLint e = B.right;
+    Node& D = nodes[d];
+    Node& E = nodes[e];
+    B.left = a;
+    B.parent = A.parent;
+    A.parent = b;
+    if (B.parent != -1) {
+      if (nodes[B.parent].left == a) {
+        nodes[B.parent].left = b;
+      } else {
+        nodes[B.parent].right = b;
+      }
+    } else {
+      root = b;
+    }
+    const bool keepD = D.height > E.height;
+    const GLint kept = keepD ? d : e;
+    const GLint moved = keepD ? e : d;
+    B.right = kept;
+    A.left = moved;
+    nodes[moved].parent = a;
+    A.min = glm::min(C.min, nodes[moved].min);
+    A.max = glm::max(C.max, nodes[moved].max);
+    B.min = glm::min(A.min, nodes[kept].min);
+    B.max = glm::max(A.max, nodes[kept].max);
+    A.height = 1 + std::max(C.height, nodes[moved].height);
+    B.height = 1 + std::max(A.height, nodes[kept].height);
+    return b;
+  }
+
+  return a;
+}
+
+void SceneIndex::refit(GLint leaf) {
+  const GeometryBounds& bounds = nodes[leaf].mesh->getBounds();
+  nodes[leaf].geometryVersion = nodes[leaf].mesh->getGeometry()->getVersion();
+  const glm::vec3 extent = glm::vec3(bounds.radius * ((GLfloat) 1.0 + margin) + margin);
+  nodes[leaf].min = bounds.position - extent;
+  nodes[leaf].max = bounds.position + extent;
+}
+
+void SceneIndex::update() {
+  // Nothing asks for the bounds of a mesh that doesn't move,
+  // so the geometry changes need to be looked for here.
+  for (size_t i = 0; i < nodes.size(); i++) {
+    Node& node = nodes[i];
+    if (
+      node.mesh != nullptr
+      && !node.isDirty
+      && node.geometryVersion != node.mesh->getGeometry()->getVersion()
+    ) {
+      node.isDirty = true;
+      dirty.push_back(i);
+    }
+  }
+  // Flags stay set for the whole pass so meshes recomputing
+  // their bounds don't queue themselves again.
+  for (size_t i = 0; i < dirty.size(); i++) {
+    const GLint leaf = dirty[i];
+    Node& node = nodes[leaf];
+    const GeometryBounds& bounds = node.mesh->getBounds();
+    node.geometryVersion = node.mesh->getGeometry()->getVersion();
+    const glm::vec3 extent = glm::vec3(bounds.radius);
+    if (
+      glm::all(glm::greaterThanEqual(bounds.position - extent, node.min))
+      && glm::all(glm::lessThanEqual(bounds.position + extent, node.max))
+    ) {
+      continue;
+    }
+    removeLeaf(leaf);
+    refit(leaf);
+    insertLeaf(leaf);
+  }
+  for (const GLint leaf : dirty) {
+    nodes[leaf].isDirty = false;
+  }
+  dirty.clear();
+}
+
+GLfloat SceneIndex::getArea(const glm::vec3& min, const glm::vec3& max) {
+  const glm::vec3 e = max - min;
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
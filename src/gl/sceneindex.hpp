@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "camera.hpp"
+#include "raycaster.hpp"
+
+class Mesh;
+
+// Dynamic AABB tree of the meshes registered by the scripts.
+// Meshes queue themselves when they move and get refitted on the next query.
+// Leaves whose geometry changed since they were fitted get queued there too.
+class SceneIndex {
+  public:
+    SceneIndex();
+    ~SceneIndex();
+    void add(Mesh* mesh);
+    void remove(Mesh* mesh);
+    void queueUpdate(Mesh* mesh);
+    void intersect(Raycaster* raycaster);
+    void getInFrustum(Camera* camera, std::vector<Mesh*>& meshes);
+    void getInRadius(const glm::vec3& center, const GLfloat radius, std::vector<Mesh*>& meshes);
+  private:
+    struct Node {
+      glm::vec3 min;
+      glm::vec3 max;
+      GLint parent;
+      GLint left;
+      GLint right;
+      GLint height;
+      Mesh* mesh;
+      GLuint geometryVersion;
+      bool isDirty;
+    };
+    std::vector<Node> nodes;
+    std::vector<GLint> dirty;
+    GLint freeList;
+    GLint root;
+    GLint allocateNode();
+    void freeNode(const GLint index);
+    void insertLeaf(const GLint leaf);
+    void removeLeaf(const GLint leaf);
+    GLint balance(const GLint index);
+    void refit(GLint index);
+    void update();
+    static GLfloat getArea(const glm::vec3& min, const glm::vec3& max);
+};
@@ -1,13 +1,24 @@
 #include "shader.hpp"
+#include "../core/cache.hpp"
+#include <cstring>
 #include <sstream>
 #include <glm/gtc/type_ptr.hpp>
 
 GLuint Shader::shaderId = 1;
 GLchar Shader::infoLog[512];
+std::map<std::string, std::vector<char>> Shader::binaries;
+// Programs kept in memory before starting over (the disk cache still has them)
+static const size_t maxBinaries = 64;
 
 #define GLSL "#version 460"
 
-Shader::Shader(const char *vertexSource, const char *fragmentSource, const bool withoutVertexHeader, const bool withoutFragmentHeader):
+// GL_KHR_parallel_shader_compile (and its ARB twin) aren't in the loader
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (*PFNGLMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+Shader::Shader(const char *vertexSource, const char *fragmentSource, const bool withoutVertexHeader, const bool withoutFragmentHeader, const ShaderTransforms transforms):
   id(shaderId++),
   refs(1),
   blend(false),
@@ -15,31 +26,40 @@ Shader::Shader(const char *vertexSource, const char *fragmentSource, const bool
   depthTest(true),
   error(""),
   faceCulling(SHADER_FACE_CULLING_BACK),
+  isLinking(false),
   program(0),
   fragmentShader(0),
-  vertexShader(0)
+  vertexShader(0),
+  transforms(transforms),
+  modelMatrixUniform(-1),
+  normalMatrixUniform(-1)
 {
-  const char* vertexShaderSource[] = { withoutVertexHeader ? GLSL : vertexHeader, vertexSource };
-  if (!compile(vertexShader, GL_VERTEX_SHADER, vertexShaderSource)) {
-    return;
-  }
-
-  const char* fragmentShaderSource[] = { withoutFragmentHeader ? GLSL : fragmentHeader, fragmentSource };
-  if (!compile(fragmentShader, GL_FRAGMENT_SHADER, fragmentShaderSource)) {
-    return;
-  }
+  const char* vertexShaderSource[] = {
+    withoutVertexHeader ? GLSL : vertexHeader,
+    withoutVertexHeader ? "" : (transforms == SHADER_TRANSFORMS_BUFFER ? transformsBufferHeader : transformsUniformsHeader),
+    vertexSource
+  };
 
-  GLint success;
-  program = glCreateProgram();
-  glAttachShader(program, vertexShader);
-  glAttachShader(program, fragmentShader);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &success);
-  if (!success) {
-    glGetProgramInfoLog(program, 512, nullptr, infoLog);
-    error = "Shader program:\n";
-    error += infoLog;
+  const char* fragmentShaderSource[] = { withoutFragmentHeader ? GLSL : fragmentHeader, "", fragmentSource };
+  const std::string key = getProgramKey(vertexShaderSource, fragmentShaderSource);
+  if (loadProgram(key)) {
+    finish();
+  } else {
+    // Nothing here waits on the driver. The statuses get checked in finish,
+    // once isReady sees the program completed or something needs to use it.
+    hasParallelCompile();
+    compile(vertexShader, GL_VERTEX_SHADER, vertexShaderSource);
+    compile(fragmentShader, GL_FRAGMENT_SHADER, fragmentShaderSource);
+    link();
+    programKey = key;
+    for (GLint i = 0; i < 3; i++) {
+      sources[0] += vertexShaderSource[i];
+      sources[1] += fragmentShaderSource[i];
+    }
+    isLinking = true;
   }
+  modelMatrixUniform = getUniform("modelMatrix");
+  normalMatrixUniform = getUniform("normalMatrix");
 }
 
 Shader::~Shader() {
@@ -51,24 +71,39 @@ Shader::~Shader() {
   }
 }
 
-void Shader::use() {
-  glUseProgram(program);
-  if (blend) {
-    glEnable(GL_BLEND);
-  } else {
-    glDisable(GL_BLEND);
+bool Shader::isReady() {
+  if (!isLinking) {
+    return true;
   }
-  if (depthTest) {
-    glEnable(GL_DEPTH_TEST);
-  } else {
-    glDisable(GL_DEPTH_TEST);
+  if (hasParallelCompile()) {
+    GLint completed;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+    if (!completed) {
+      return false;
+    }
   }
-  if (faceCulling == SHADER_FACE_CULLING_NONE) {
-    glDisable(GL_CULL_FACE);
-  } else {
-    glEnable(GL_CULL_FACE);
-    glCullFace(faceCulling == SHADER_FACE_CULLING_BACK ? GL_BACK : GL_FRONT);
+  finish();
+  return true;
+}
+
+bool Shader::wait() {
+  if (isLinking) {
+    finish();
   }
+  return error.empty();
+}
+
+bool Shader::use() {
+  if (!wait()) {
+    return false;
+  }
+  GLState::useProgram(program);
+  GLState::setBlend(blend);
+  GLState::setDepthTest(depthTest);
+  GLState::setCullFace(
+    faceCulling == SHADER_FACE_CULLING_NONE ? GL_NONE : (faceCulling == SHADER_FACE_CULLING_BACK ? GL_BACK : GL_FRONT)
+  );
+  return true;
 }
 
 bool Shader::getBlend() {
@@ -99,7 +134,14 @@ void Shader::setFaceCulling(const ShaderFaceCulling mode) {
   faceCulling = mode;
 }
 
+ShaderTransforms Shader::getTransforms() {
+  return transforms;
+}
+
 void Shader::setCameraUniforms(Camera* camera) {
+  camera->updateBuffer();
+  // Shaders with the default headers read the camera from the shared
+  // uniform block. This only reaches the ones declaring their own uniforms.
   if (cameraUniformsVersion == camera->getVersion()) {
     return;
   }
@@ -109,8 +151,40 @@ void Shader::setCameraUniforms(Camera* camera) {
   setUniformMat4("projectionMatrix", camera->getProjection());
 }
 
+GLint Shader::getUniform(const char* name) {
+  const auto handle = uniformHandles.find(name);
+  if (handle != uniformHandles.end()) {
+    return handle->second;
+  }
+  // Array elements past the first aren't reflected. Resolve them once
+  // and remember misses too, so unknown names don't hit the driver again.
+  // While linking, every name gets a handle that finish resolves later.
+  GLint uniform = -1;
+  if (isLinking) {
+    uniform = uniforms.size();
+    uniforms.push_back({ -1, {}, false, GL_NONE });
+  } else if (program != 0 && error.empty()) {
+    const GLint location = glGetUniformLocation(program, name);
+    if (location != -1) {
+      uniform = uniforms.size();
+      uniforms.push_back({ location, {}, false, GL_NONE });
+    }
+  }
+  uniformHandles[name] = uniform;
+  return uniform;
+}
+
+void Shader::setModelUniforms(Drawbuffer* drawbuffer, const glm::mat4& modelMatrix, const glm::mat3& normalMatrix) {
+  if (transforms == SHADER_TRANSFORMS_BUFFER) {
+    drawbuffer->bind(modelMatrix, normalMatrix);
+    return;
+  }
+  setUniformMat4(modelMatrixUniform, modelMatrix);
+  setUniformMat3(normalMatrixUniform, normalMatrix);
+}
+
 bool Shader::hasUniform(const char* name) {
-  return glGetUniformLocation(program, name) != -1;
+  return getUniform(name) != -1;
 }
 
 void Shader::setTextureUniforms(std::map<std::string, Texture*>* extra) {
@@ -134,19 +208,11 @@ void Shader::setTextureUniforms(std::map<std::string, Texture*>* extra) {
 }
 
 void Shader::setUniformInt(const char* name, const GLint value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniform1i(location, value);
-  }
+  setUniformInt(getUniform(name), value);
 }
 
 void Shader::setUniformFloat(const char* name, const GLfloat value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniform1f(location, value);
-  }
+  setUniformFloat(getUniform(name), value);
 }
 
 void Shader::setUniformTexture(const std::string& name, Texture* texture) {
@@ -158,50 +224,61 @@ void Shader::setUniformTexture(const std::string& name, Texture* texture) {
 }
 
 void Shader::setUniformMat3(const char* name, const glm::mat3 &value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
-  }
+  setUniformMat3(getUniform(name), value);
 }
 
 void Shader::setUniformMat4(const char* name, const glm::mat4 &value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
-  }
+  setUniformMat4(getUniform(name), value);
 }
 
 void Shader::setUniformVec2(const char* name, const glm::vec2 &value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniform2fv(location, 1, glm::value_ptr(value));
-  }
+  setUniformVec2(getUniform(name), value);
 }
 
 void Shader::setUniformVec3(const char* name, const glm::vec3 &value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniform3fv(location, 1, glm::value_ptr(value));
-  }
+  setUniformVec3(getUniform(name), value);
 }
 
 void Shader::setUniformVec4(const char* name, const glm::vec4 &value) {
-  GLint location = glGetUniformLocation(program, name);
-  if (location != -1) {
-    glUseProgram(program);
-    glUniform4fv(location, 1, glm::value_ptr(value));
-  }
+  setUniformVec4(getUniform(name), value);
 }
 
-bool Shader::compile(GLuint& shader, const GLenum type, const GLchar** source) {
-  GLint success;
+void Shader::setUniformInt(const GLint uniform, const GLint value) {
+  setUniform(uniform, GL_INT, &value, sizeof(value));
+}
+
+void Shader::setUniformFloat(const GLint uniform, const GLfloat value) {
+  setUniform(uniform, GL_FLOAT, &value, sizeof(value));
+}
+
+void Shader::setUniformMat3(const GLint uniform, const glm::mat3& value) {
+  setUniform(uniform, GL_FLOAT_MAT3, glm::value_ptr(value), sizeof(value));
+}
+
+void Shader::setUniformMat4(const GLint uniform, const glm::mat4& value) {
+  setUniform(uniform, GL_FLOAT_MAT4, glm::value_ptr(value), sizeof(value));
+}
+
+void Shader::setUniformVec2(const GLint uniform, const glm::vec2& value) {
+  setUniform(uniform, GL_FLOAT_VEC2, glm::value_ptr(value), sizeof(value));
+}
+
+void Shader::setUniformVec3(const GLint uniform, const glm::vec3& value) {
+  setUniform(uniform, GL_FLOAT_VEC3, glm::value_ptr(value), sizeof(value));
+}
+
+void Shader::setUniformVec4(const GLint uniform, const glm::vec4& value) {
+  setUniform(uniform, GL_FLOAT_VEC4, glm::value_ptr(value), sizeof(value));
+}
+
+void Shader::compile(GLuint& shader, const GLenum type, const GLchar** source) {
   shader = glCreateShader(type);
-  glShaderSource(shader, 2, source, nullptr);
+  glShaderSource(shader, 3, source, nullptr);
   glCompileShader(shader);
+}
+
+bool Shader::checkCompile(const GLuint shader, const GLenum type, const std::string& source) {
+  GLint success;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
   if (success) {
     return true;
@@ -210,7 +287,7 @@ bool Shader::compile(GLuint& shader, const GLenum type, const GLchar** source) {
   error = (type == GL_VERTEX_SHADER ? "Vertex" : "Fragment");
   error += " shader:\n";
   const std::vector<std::string> errors = getLines(infoLog);
-  const std::vector<std::string> lines = getLines(std::string(source[0]) + std::string(source[1]));
+  const std::vector<std::string> lines = getLines(source);
   for (const auto& e : errors) {
     GLint start = e.find("0("); 
     GLint end = e.find(") : error", start + 2);
@@ -227,6 +304,263 @@ bool Shader::compile(GLuint& shader, const GLenum type, const GLchar** source) {
   return false;
 }
 
+void Shader::link() {
+  program = glCreateProgram();
+  glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glAttachShader(program, vertexShader);
+  glAttachShader(program, fragmentShader);
+  glLinkProgram(program);
+}
+
+void Shader::finish() {
+  isLinking = false;
+  GLint success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    if (
+      checkCompile(vertexShader, GL_VERTEX_SHADER, sources[0])
+      && checkCompile(fragmentShader, GL_FRAGMENT_SHADER, sources[1])
+    ) {
+      glGetProgramInfoLog(program, 512, nullptr, infoLog);
+      error = "Shader program:\n";
+      error += infoLog;
+    }
+  } else if (!programKey.empty()) {
+    storeProgram(programKey);
+  }
+  programKey.clear();
+  sources[0].clear();
+  sources[1].clear();
+  if (!error.empty()) {
+    return;
+  }
+  reflectUniforms();
+  // Resolve the handles given out while linking and upload what
+  // got set on them. Names that turned out inactive become misses.
+  for (auto& [name, uniform] : uniformHandles) {
+    if (uniform == -1 || uniforms[uniform].location != -1) {
+      continue;
+    }
+    const GLint location = glGetUniformLocation(program, name.c_str());
+    if (location == -1) {
+      uniform = -1;
+      continue;
+    }
+    uniforms[uniform].location = location;
+  }
+  for (const auto& uniform : uniforms) {
+    if (uniform.hasValue) {
+      uploadUniform(uniform);
+    }
+  }
+  std::erase_if(uniformsTexture, [this](const auto& entry) {
+    if (getUniform(entry.first.c_str()) != -1) {
+      return false;
+    }
+    Texture::gc(entry.second);
+    return true;
+  });
+}
+
+bool Shader::hasParallelCompile() {
+  // Lets the driver compile and link on its own threads,
+  // so polling GL_COMPLETION_STATUS_KHR doesn't block.
+  static const bool supported = []() {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+      const char* extension = (const char*) glGetStringi(GL_EXTENSIONS, i);
+      const bool isKHR = std::strcmp(extension, "GL_KHR_parallel_shader_compile") == 0;
+      if (!isKHR && std::strcmp(extension, "GL_ARB_parallel_shader_compile") != 0) {
+        continue;
+      }
+      PFNGLMAXSHADERCOMPILERTHREADSPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROC) glfwGetProcAddress(
+        isKHR ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB"
+      );
+      if (maxShaderCompilerThreads != nullptr) {
+        // Let the implementation pick the number of threads
+        maxShaderCompilerThreads(0xFFFFFFFF);
+      }
+      return true;
+    }
+    return false;
+  }();
+  return supported;
+}
+
+const std::string& Shader::getDriver() {
+  // Binaries are only valid for the exact driver that produced them
+  static const std::string driver = []() {
+    std::string driver;
+    for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION }) {
+      const GLubyte* value = glGetString(name);
+      if (value != nullptr) {
+        driver += (const char*) value;
+      }
+      driver += "\n";
+    }
+    return driver;
+  }();
+  return driver;
+}
+
+std::string Shader::getProgramKey(const GLchar** vertexSource, const GLchar** fragmentSource) {
+  const std::string& driver = getDriver();
+  uint64_t hash = Cache::hash(driver.data(), driver.size());
+  for (const GLchar** source : { vertexSource, fragmentSource }) {
+    for (GLint i = 0; i < 3; i++) {
+      // Include the terminator so moving text between the parts changes the key
+      hash = Cache::hash(source[i], std::strlen(source[i]) + 1, hash);
+    }
+  }
+  return Cache::key(hash);
+}
+
+bool Shader::loadProgram(const std::string& key) {
+  // Compiled programs are kept as binaries instead of being shared, since
+  // uniform values live in the program and every Shader sets its own.
+  auto binary = binaries.find(key);
+  if (binary == binaries.end()) {
+    std::vector<char> data;
+    const std::string& driver = getDriver();
+    if (
+      !Cache::read("programs", key, data)
+      || data.size() <= driver.size() + sizeof(GLenum)
+      || std::memcmp(data.data(), driver.data(), driver.size()) != 0
+    ) {
+      return false;
+    }
+    data.erase(data.begin(), data.begin() + driver.size());
+    keepBinary(key, std::move(data));
+    binary = binaries.find(key);
+  }
+  GLenum format;
+  std::memcpy(&format, binary->second.data(), sizeof(GLenum));
+  GLint success;
+  program = glCreateProgram();
+  glProgramBinary(program, format, binary->second.data() + sizeof(GLenum), binary->second.size() - sizeof(GLenum));
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // Rejected by the driver (usually after an update). Compile it again.
+    glDeleteProgram(program);
+    program = 0;
+    binaries.erase(binary);
+    return false;
+  }
+  return true;
+}
+
+void Shader::storeProgram(const std::string& key) {
+  GLint size = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) {
+    return;
+  }
+  std::vector<char> data(sizeof(GLenum) + size);
+  GLenum format;
+  glGetProgramBinary(program, size, nullptr, &format, data.data() + sizeof(GLenum));
+  std::memcpy(data.data(), &format, sizeof(GLenum));
+  const std::string& driver = getDriver();
+  std::vector<char> file(driver.begin(), driver.end());
+  file.insert(file.end(), data.begin(), data.end());
+  Cache::write("programs", key, file.data(), file.size());
+  keepBinary(key, std::move(data));
+}
+
+void Shader::keepBinary(const std::string& key, std::vector<char>&& data) {
+  if (binaries.size() >= maxBinaries && !binaries.contains(key)) {
+    binaries.clear();
+  }
+  binaries[key] = std::move(data);
+}
+
+void Shader::reflectUniforms() {
+  GLint count;
+  GLint maxLength;
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+  std::vector<GLchar> name(glm::max(maxLength, (GLint) 1));
+  for (GLint i = 0; i < count; i++) {
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(program, i, name.size(), nullptr, &size, &type, name.data());
+    const GLint location = glGetUniformLocation(program, name.data());
+    if (location == -1) {
+      // Uniform block members don't have a location
+      continue;
+    }
+    std::string key(name.data());
+    if (key.ends_with("[0]")) {
+      key = key.substr(0, key.size() - 3);
+    }
+    // Handles given out while linking keep pointing at the same uniform
+    for (const std::string& alias : { key, key + "[0]" }) {
+      const auto handle = uniformHandles.find(alias);
+      if (handle != uniformHandles.end() && handle->second != -1) {
+        uniforms[handle->second].location = location;
+      }
+    }
+    if (!uniformHandles.contains(key)) {
+      uniformHandles[key] = uniforms.size();
+      uniforms.push_back({ location, {}, false, GL_NONE });
+    }
+    if (std::string(name.data()) != key && !uniformHandles.contains(name.data())) {
+      uniformHandles[name.data()] = uniformHandles[key];
+    }
+  }
+}
+
+void Shader::setUniform(const GLint uniform, const GLenum type, const void* value, const size_t size) {
+  if (uniform < 0 || uniform >= (GLint) uniforms.size()) {
+    return;
+  }
+  // Uniform values live in the program, so the last value
+  // uploaded is still current no matter which program is bound.
+  ShaderUniform& cached = uniforms[uniform];
+  if (cached.hasValue && cached.type == type && std::memcmp(cached.value, value, size) == 0) {
+    return;
+  }
+  std::memcpy(cached.value, value, size);
+  cached.hasValue = true;
+  cached.type = type;
+  if (!isLinking) {
+    uploadUniform(cached);
+  }
+}
+
+void Shader::uploadUniform(const ShaderUniform& uniform) {
+  if (uniform.location == -1) {
+    return;
+  }
+  const GLfloat* value = uniform.value;
+  switch (uniform.type) {
+    case GL_INT: {
+      GLint integer;
+      std::memcpy(&integer, value, sizeof(integer));
+      glProgramUniform1i(program, uniform.location, integer);
+      break;
+    }
+    case GL_FLOAT:
+      glProgramUniform1f(program, uniform.location, value[0]);
+      break;
+    case GL_FLOAT_VEC2:
+      glProgramUniform2fv(program, uniform.location, 1, value);
+      break;
+    case GL_FLOAT_VEC3:
+      glProgramUniform3fv(program, uniform.location, 1, value);
+      break;
+    case GL_FLOAT_VEC4:
+      glProgramUniform4fv(program, uniform.location, 1, value);
+      break;
+    case GL_FLOAT_MAT3:
+      glProgramUniformMatrix3fv(program, uniform.location, 1, GL_FALSE, value);
+      break;
+    case GL_FLOAT_MAT4:
+      glProgramUniformMatrix4fv(program, uniform.location, 1, GL_FALSE, value);
+      break;
+  }
+}
+
 std::vector<std::string> Shader::getLines(const std::string& text) {
   std::vector<std::string> lines;
   std::stringstream ss(text);
@@ -260,23 +594,60 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
 layout (location = 3) in vec3 color;
-uniform mat3 normalMatrix;
-uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+layout(std140, binding = 0) uniform CameraUniforms {
+  mat4 viewMatrix;
+  mat4 projectionMatrix;
+  vec3 viewPosition;
+};
 uniform vec2 resolution;
 uniform float time;
 )"""";
 
+const char* Shader::transformsUniformsHeader =
+R""""(
+uniform mat3 normalMatrix;
+uniform mat4 modelMatrix;
+)"""";
+
+const char* Shader::transformsBufferHeader =
+R""""(
+struct MeshTransform {
+  mat4 modelTransform;
+  mat3 normalTransform;
+};
+layout(std430, binding = 1) readonly buffer MeshUniforms {
+  MeshTransform meshTransforms[];
+};
+// Merged draws flag themselves with a non-zero base instance
+#define meshTransform meshTransforms[gl_BaseInstance != 0 ? gl_InstanceID : 0]
+#define modelMatrix meshTransform.modelTransform
+#define normalMatrix meshTransform.normalTransform
+)"""";
+
 const char* Shader::fragmentHeader =
 GLSL
 R""""(
 layout(location = 0) out vec4 fragOutput0;
 #define gl_FragColor fragOutput0
-uniform vec3 viewPosition;
+layout(std140, binding = 0) uniform CameraUniforms {
+  mat4 viewMatrix;
+  mat4 projectionMatrix;
+  vec3 viewPosition;
+};
 uniform vec2 resolution;
 uniform float time;
 vec4 sRGB(in vec4 value) {
 return clamp(vec4(mix(pow(value.rgb, vec3(0.41666)) * 1.055 - vec3(0.055), value.rgb * 12.92, vec3(lessThanEqual(value.rgb, vec3(0.0031308)))), value.a), 0.0, 1.0);
 }
+// Irradiance from L2 spherical harmonics, scaled like the irradiance maps
+vec3 irradianceSH(in vec3 sh[9], in vec3 n) {
+return max(
+  sh[0] * 0.282095
+  + (sh[1] * n.y + sh[2] * n.z + sh[3] * n.x) * 0.325735
+  + (sh[4] * n.x * n.y + sh[5] * n.y * n.z + sh[7] * n.x * n.z) * 0.273137
+  + sh[6] * 0.078848 * (3.0 * n.z * n.z - 1.0)
+  + sh[8] * 0.136569 * (n.x * n.x - n.y * n.y),
+  0.0
+);
+}
 )"""";
@@ -7,6 +7,7 @@
 #include <string>
 #include <vector>
 #include "camera.hpp"
+#include "drawbuffer.hpp"
 #include "texture.hpp"
 
 enum ShaderFaceCulling {
@@ -22,13 +23,33 @@ static const char* ShaderFaceCullingNames[] = {
   nullptr
 };
 
+enum ShaderTransforms {
+  SHADER_TRANSFORMS_UNIFORMS,
+  SHADER_TRANSFORMS_BUFFER
+};
+
+static const char* ShaderTransformsNames[] = {
+  "uniforms",
+  "buffer",
+  nullptr
+};
+
+struct ShaderUniform {
+  GLint location;
+  GLfloat value[16];
+  bool hasValue;
+  GLenum type;
+};
+
 class Shader {
   public:
     const GLuint id;
     GLuint refs;
-    Shader(const char *vertexSource, const char *fragmentSource, const bool withoutVertexHeader = false, const bool withoutFragmentHeader = false);
+    Shader(const char *vertexSource, const char *fragmentSource, const bool withoutVertexHeader = false, const bool withoutFragmentHeader = false, const ShaderTransforms transforms = SHADER_TRANSFORMS_UNIFORMS);
     ~Shader();
-    void use();
+    bool isReady();
+    bool wait();
+    bool use();
     bool getBlend();
     void setBlend(const bool enabled);
     bool getDepthTest();
@@ -36,8 +57,11 @@ class Shader {
     const std::string& getError();
     ShaderFaceCulling getFaceCulling();
     void setFaceCulling(const ShaderFaceCulling mode);
+    ShaderTransforms getTransforms();
+    GLint getUniform(const char* name);
     bool hasUniform(const char* name);
     void setCameraUniforms(Camera* camera);
+    void setModelUniforms(Drawbuffer* drawbuffer, const glm::mat4& modelMatrix, const glm::mat3& normalMatrix);
     void setTextureUniforms(std::map<std::string, Texture*>* extra = nullptr);
     void setUniformInt(const char* name, const GLint value);
     void setUniformFloat(const char* name, const GLfloat value);
@@ -47,6 +71,13 @@ class Shader {
     void setUniformVec2(const char* name, const glm::vec2& value);
     void setUniformVec3(const char* name, const glm::vec3& value);
     void setUniformVec4(const char* name, const glm::vec4& value);
+    void setUniformInt(const GLint uniform, const GLint value);
+    void setUniformFloat(const GLint uniform, const GLfloat value);
+    void setUniformMat3(const GLint uniform, const glm::mat3& value);
+    void setUniformMat4(const GLint uniform, const glm::mat4& value);
+    void setUniformVec2(const GLint uniform, const glm::vec2& value);
+    void setUniformVec3(const GLint uniform, const glm::vec3& value);
+    void setUniformVec4(const GLint uniform, const glm::vec4& value);
     static std::string getLinesNear(const std::string& text, const GLint line);
   private:
     static GLuint shaderId;
@@ -55,14 +86,37 @@ class Shader {
     bool depthTest;
     std::string error;
     ShaderFaceCulling faceCulling;
+    bool isLinking;
     GLuint program;
+    std::string programKey;
+    std::string sources[2];
     GLuint fragmentShader;
     GLuint vertexShader;
+    ShaderTransforms transforms;
+    GLint modelMatrixUniform;
+    GLint normalMatrixUniform;
+    std::map<std::string, GLint> uniformHandles;
+    std::vector<ShaderUniform> uniforms;
     std::map<std::string, Texture*> uniformsTexture;
     static const char* vertexHeader;
     static const char* fragmentHeader;
+    static const char* transformsUniformsHeader;
+    static const char* transformsBufferHeader;
     static GLchar infoLog[];
-    bool compile(GLuint& shader, const GLenum type, const GLchar** source);
+    static std::map<std::string, std::vector<char>> binaries;
+    void compile(GLuint& shader, const GLenum type, const GLchar** source);
+    bool checkCompile(const GLuint shader, const GLenum type, const std::string& source);
+    void link();
+    void finish();
+    static bool hasParallelCompile();
+    bool loadProgram(const std::string& key);
+    void storeProgram(const std::string& key);
+    static void keepBinary(const std::string& key, std::vector<char>&& data);
+    static const std::string& getDriver();
+    static std::string getProgramKey(const GLchar** vertexSource, const GLchar** fragmentSource);
+    void reflectUniforms();
+    void setUniform(const GLint uniform, const GLenum type, const void* value, const size_t size);
+    void uploadUniform(const ShaderUniform& uniform);
     static std::string getLinesNear(const std::vector<std::string>& lines, const GLint line);
     static std::vector<std::string> getLines(const std::string& text);
 };
@@ -13,7 +13,7 @@ Texture::Texture(const GLenum binding):
 
 Texture::~Texture() {
   if (texture != 0) {
-    glDeleteTextures(1, &texture);
+    GLState::deleteTextures(1, &texture);
   }
 }
 
@@ -25,8 +25,7 @@ void Texture::gc(Texture* texture) {
 }
 
 void Texture::bind(const GLint target) {
-  glActiveTexture(GL_TEXTURE0 + target);
-  glBindTexture(binding, get());
+  GLState::bindTexture(target, binding, get());
 }
 
 GLuint Texture::get() {
@@ -0,0 +1,441 @@
+#include "texturecodec.hpp"
+#include "../core/cache.hpp"
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// S3TC is an extension, so it isn't in the loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+struct TextureCodecFormat {
+  uint32_t source;
+  GLenum format;
+  // Bytes per 4x4 block. Zero for uncompressed RGBA8.
+  GLuint blockSize;
+};
+
+static const TextureCodecFormat vkFormats[] = {
+  { 37, GL_RGBA8, 0 },
+  { 43, GL_SRGB8_ALPHA8, 0 },
+  { 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8 },
+  { 132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 8 },
+  { 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 },
+  { 134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8 },
+  { 135, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16 },
+  { 136, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16 },
+  { 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 },
+  { 138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16 },
+  { 139, GL_COMPRESSED_RED_RGTC1, 8 },
+  { 140, GL_COMPRESSED_SIGNED_RED_RGTC1, 8 },
+  { 141, GL_COMPRESSED_RG_RGTC2, 16 },
+  { 142, GL_COMPRESSED_SIGNED_RG_RGTC2, 16 },
+  { 143, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16 },
+  { 144, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 16 },
+  { 145, GL_COMPRESSED_RGBA_BPTC_UNORM, 16 },
+  { 146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16 },
+  { 147, GL_COMPRESSED_RGB8_ETC2, 8 },
+  { 148, GL_COMPRESSED_SRGB8_ETC2, 8 },
+  { 149, GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, 8 },
+  { 150, GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2, 8 },
+  { 151, GL_COMPRESSED_RGBA8_ETC2_EAC, 16 },
+  { 152, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, 16 },
+  { 153, GL_COMPRESSED_R11_EAC, 8 },
+  { 154, GL_COMPRESSED_SIGNED_R11_EAC, 8 },
+  { 155, GL_COMPRESSED_RG11_EAC, 16 },
+  { 156, GL_COMPRESSED_SIGNED_RG11_EAC, 16 },
+};
+
+static const TextureCodecFormat dxgiFormats[] = {
+  { 28, GL_RGBA8, 0 },
+  { 29, GL_SRGB8_ALPHA8, 0 },
+  { 71, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 },
+  { 72, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8 },
+  { 74, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16 },
+  { 75, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16 },
+  { 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 },
+  { 78, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16 },
+  { 80, GL_COMPRESSED_RED_RGTC1, 8 },
+  { 81, GL_COMPRESSED_SIGNED_RED_RGTC1, 8 },
+  { 83, GL_COMPRESSED_RG_RGTC2, 16 },
+  { 84, GL_COMPRESSED_SIGNED_RG_RGTC2, 16 },
+  { 95, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16 },
+  { 96, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 16 },
+  { 98, GL_COMPRESSED_RGBA_BPTC_UNORM, 16 },
+  { 99, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16 },
+};
+
+static const TextureCodecFormat* findFormat(const TextureCodecFormat* formats, const size_t count, const uint32_t source) {
+  for (size_t i = 0; i < count; i++) {
+    if (formats[i].source == source) {
+      return &formats[i];
+    }
+  }
+  return nullptr;
+}
+
+static uint32_t read32(const unsigned char* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t read64(const unsigned char* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static size_t getLevelSize(const GLsizei width, const GLsizei height, const GLuint blockSize) {
+  if (blockSize == 0) {
+    return (size_t) width * height * 4;
+  }
+  return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+}
+
+static uint32_t fourCC(const char* code) {
+  return read32((const unsigned char*) code);
+}
+
+bool TextureCodec::load(const unsigned char* data, const size_t size, const bool srgb, TextureCodecData& texture) {
+  static const unsigned char ktx2[] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+  bool loaded = false;
+  if (size >= sizeof(ktx2) && std::memcmp(data, ktx2, sizeof(ktx2)) == 0) {
+    loaded = loadKTX2(data, size, texture);
+  } else if (size >= 4 && read32(data) == fourCC("DDS ")) {
+    loaded = loadDDS(data, size, srgb, texture);
+  }
+  if (!loaded) {
+    texture.levels.clear();
+    texture.pixels.clear();
+  }
+  return loaded;
+}
+
+bool TextureCodec::loadDDS(const unsigned char* data, const size_t size, const bool srgb, TextureCodecData& texture) {
+  // Legacy DDS files don't say whether they hold sRGB data,
+  // so the image encoding picks for them.
+  if (size < 128 || read32(data + 4) != 124) {
+    return false;
+  }
+  const GLsizei height = read32(data + 12);
+  const GLsizei width = read32(data + 16);
+  const GLuint mipmaps = (read32(data + 8) & 0x20000) ? read32(data + 28) : 1;
+  const uint32_t format = read32(data + 84);
+  const uint32_t caps2 = read32(data + 112);
+  if (caps2 & 0x200) {
+    // Cubemaps
+    return false;
+  }
+  size_t offset = 128;
+  TextureCodecFormat legacy;
+  const TextureCodecFormat* match = nullptr;
+  if (format == fourCC("DX10")) {
+    if (size < 148 || read32(data + 132) != 3 || (read32(data + 136) & 0x4) || read32(data + 140) > 1) {
+      // Only plain 2D textures
+      return false;
+    }
+    match = findFormat(dxgiFormats, sizeof(dxgiFormats) / sizeof(TextureCodecFormat), read32(data + 128));
+    offset = 148;
+  } else {
+    legacy = { format, 0, 16 };
+    if (format == fourCC("DXT1")) {
+      legacy.format = srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+      legacy.blockSize = 8;
+    } else if (format == fourCC("DXT3")) {
+      legacy.format = srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT : GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+    } else if (format == fourCC("DXT5")) {
+      legacy.format = srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    } else if (format == fourCC("ATI1") || format == fourCC("BC4U")) {
+      legacy.format = GL_COMPRESSED_RED_RGTC1;
+      legacy.blockSize = 8;
+    } else if (format == fourCC("ATI2") || format == fourCC("BC5U")) {
+      legacy.format = GL_COMPRESSED_RG_RGTC2;
+    }
+    match = legacy.format != 0 ? &legacy : nullptr;
+  }
+  if (match == nullptr || width <= 0 || height <= 0) {
+    return false;
+  }
+  texture.format = match->format;
+  texture.isCompressed = match->blockSize != 0;
+  texture.levels.clear();
+  texture.pixels.clear();
+  GLsizei w = width;
+  GLsizei h = height;
+  for (GLuint level = 0; level < glm::max(mipmaps, (GLuint) 1); level++) {
+    const size_t levelSize = getLevelSize(w, h, match->blockSize);
+    if (offset + levelSize > size) {
+      return false;
+    }
+    texture.levels.push_back({ w, h, texture.pixels.size(), levelSize });
+    texture.pixels.insert(texture.pixels.end(), data + offset, data + offset + levelSize);
+    offset += levelSize;
+    w = glm::max(w / 2, 1);
+    h = glm::max(h / 2, 1);
+  }
+  return true;
+}
+
+bool TextureCodec::loadKTX2(const unsigned char* data, const size_t size, TextureCodecData& texture) {
+  if (size < 80) {
+    return false;
+  }
+  const uint32_t vkFormat = read32(data + 12);
+  const GLsizei width = read32(data + 20);
+  const GLsizei height = read32(data + 24);
+  const uint32_t depth = read32(data + 28);
+  const uint32_t layers = read32(data + 32);
+  const uint32_t faces = read32(data + 36);
+  const GLuint levels = glm::max(read32(data + 40), (uint32_t) 1);
+  const uint32_t supercompression = read32(data + 44);
+  // Only plain 2D textures without supercompression (Basis/zstd need a transcoder)
+  if (depth > 0 || layers > 0 || faces != 1 || supercompression != 0 || width <= 0 || height <= 0) {
+    return false;
+  }
+  const TextureCodecFormat* match = findFormat(vkFormats, sizeof(vkFormats) / sizeof(TextureCodecFormat), vkFormat);
+  if (match == nullptr || size < 80 + (size_t) levels * 24) {
+    return false;
+  }
+  texture.format = match->format;
+  texture.isCompressed = match->blockSize != 0;
+  texture.levels.clear();
+  texture.pixels.clear();
+  GLsizei w = width;
+  GLsizei h = height;
+  for (GLuint level = 0; level < levels; level++) {
+    const unsigned char* index = data + 80 + level * 24;
+    const uint64_t offset = read64(index);
+    const uint64_t length = read64(index + 8);
+    const size_t levelSize = getLevelSize(w, h, match->blockSize);
+    if (length != levelSize || offset + length > size) {
+      return false;
+    }
+    texture.levels.push_back({ w, h, texture.pixels.size(), levelSize });
+    texture.pixels.insert(texture.pixels.end(), data + offset, data + offset + length);
+    w = glm::max(w / 2, 1);
+    h = glm::max(h / 2, 1);
+  }
+  return true;
+}
+
+void TextureCodec::compress(const unsigned char* rgba, const GLsizei width, const GLsizei height, const bool srgb, TextureCodecData& texture) {
+  bool withAlpha = false;
+  for (size_t i = 3, l = (size_t) width * height * 4; i < l; i += 4) {
+    if (rgba[i] != 255) {
+      withAlpha = true;
+      break;
+    }
+  }
+  if (withAlpha) {
+    texture.format = srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  } else {
+    texture.format = srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  }
+  texture.isCompressed = true;
+  texture.levels.clear();
+  texture.pixels.clear();
+  const GLuint blockSize = withAlpha ? 16 : 8;
+  std::vector<unsigned char> level(rgba, rgba + (size_t) width * height * 4);
+  GLsizei w = width;
+  GLsizei h = height;
+  unsigned char block[64];
+  while (true) {
+    const size_t offset = texture.pixels.size();
+    texture.levels.push_back({ w, h, offset, getLevelSize(w, h, blockSize) });
+    texture.pixels.resize(offset + texture.levels.back().size);
+    unsigned char* output = texture.pixels.data() + offset;
+    for (GLsizei by = 0; by < h; by += 4) {
+      for (GLsizei bx = 0; bx < w; bx += 4, output += blockSize) {
+        // Edge blocks repeat the last row/column
+        for (GLsizei y = 0; y < 4; y++) {
+          for (GLsizei x = 0; x < 4; x++) {
+            const size_t pixel = ((size_t) glm::min(by + y, h - 1) * w + glm::min(bx + x, w - 1)) * 4;
+            std::memcpy(block + (y * 4 + x) * 4, level.data() + pixel, 4);
+          }
+        }
+        encodeBlock(block, withAlpha, output);
+      }
+    }
+    if (w == 1 && h == 1) {
+      break;
+    }
+    level = downsample(level, w, h, srgb);
+    w = glm::max(w / 2, 1);
+    h = glm::max(h / 2, 1);
+  }
+}
+
+bool TextureCodec::read(const std::string& key, TextureCodecData& texture) {
+  std::vector<char> data;
+  if (!Cache::read("textures", key, data) || data.size() < sizeof(uint32_t) * 3) {
+    return false;
+  }
+  const unsigned char* bytes = (const unsigned char*) data.data();
+  const uint32_t count = read32(bytes + 8);
+  const size_t header = sizeof(uint32_t) * 3 + (size_t) count * sizeof(uint64_t) * 4;
+  if (count == 0 || data.size() < header) {
+    return false;
+  }
+  texture.format = read32(bytes);
+  texture.isCompressed = read32(bytes + 4) != 0;
+  texture.levels.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    const unsigned char* level = bytes + sizeof(uint32_t) * 3 + i * sizeof(uint64_t) * 4;
+    texture.levels.push_back({
+      (GLsizei) read64(level),
+      (GLsizei) read64(level + 8),
+      (size_t) read64(level + 16),
+      (size_t) read64(level + 24)
+    });
+    if (texture.levels.back().offset + texture.levels.back().size > data.size() - header) {
+      texture.levels.clear();
+      return false;
+    }
+  }
+  texture.pixels.assign(bytes + header, bytes + data.size());
+  return true;
+}
+
+void TextureCodec::write(const std::string& key, const TextureCodecData& texture) {
+  std::vector<unsigned char> data(sizeof(uint32_t) * 3 + texture.levels.size() * sizeof(uint64_t) * 4);
+  const uint32_t header[] = { texture.format, texture.isCompressed, (uint32_t) texture.levels.size() };
+  std::memcpy(data.data(), header, sizeof(header));
+  for (size_t i = 0; i < texture.levels.size(); i++) {
+    const TextureCodecLevel& level = texture.levels[i];
+    const uint64_t values[] = { (uint64_t) level.width, (uint64_t) level.height, level.offset, level.size };
+    std::memcpy(data.data() + sizeof(header) + i * sizeof(values), values, sizeof(values));
+  }
+  data.insert(data.end(), texture.pixels.begin(), texture.pixels.end());
+  Cache::write("textures", key, data.data(), data.size());
+}
+
+std::vector<unsigned char> TextureCodec::downsample(const std::vector<unsigned char>& rgba, const GLsizei width, const GLsizei height, const bool srgb) {
+  // Box filter. sRGB colors get averaged in linear space, like glGenerateMipmap does.
+  static const auto toLinear = []() {
+    std::vector<GLfloat> table(256);
+    for (GLint i = 0; i < 256; i++) {
+      const GLfloat c = (GLfloat) i / 255.0;
+      table[i] = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+    }
+    return table;
+  }();
+  const GLsizei w = glm::max(width / 2, 1);
+  const GLsizei h = glm::max(height / 2, 1);
+  std::vector<unsigned char> output((size_t) w * h * 4);
+  for (GLsizei y = 0; y < h; y++) {
+    for (GLsizei x = 0; x < w; x++) {
+      const GLsizei sx[] = { glm::min(x * 2, width - 1), glm::min(x * 2 + 1, width - 1) };
+      const GLsizei sy[] = { glm::min(y * 2, height - 1), glm::min(y * 2 + 1, height - 1) };
+      for (GLint c = 0; c < 4; c++) {
+        GLfloat sum = 0;
+        for (GLint i = 0; i < 4; i++) {
+          const unsigned char value = rgba[((size_t) sy[i / 2] * width + sx[i % 2]) * 4 + c];
+          sum += srgb && c < 3 ? toLinear[value] : (GLfloat) value / 255.0;
+        }
+        GLfloat value = sum / 4.0;
+        if (srgb && c < 3) {
+          value = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, (GLfloat) (1.0 / 2.4)) - 0.055;
+        }
+        output[((size_t) y * w + x) * 4 + c] = (unsigned char) glm::clamp(value * 255.0 + 0.5, 0.0, 255.0);
+      }
+    }
+  }
+  return output;
+}
+
+void TextureCodec::encodeBlock(const unsigned char* block, const bool withAlpha, unsigned char* output) {
+  // Bounding box endpoints, inset a bit to reduce the error at the ends
+  // (van Waveren's "Real-Time DXT Compression"). Fast rather than optimal.
+  if (withAlpha) {
+    GLint minAlpha = 255;
+    GLint maxAlpha = 0;
+    for (GLint i = 0; i < 16; i++) {
+      minAlpha = glm::min(minAlpha, (GLint) block[i * 4 + 3]);
+      maxAlpha = glm::max(maxAlpha, (GLint) block[i * 4 + 3]);
+    }
+    output[0] = maxAlpha;
+    output[1] = minAlpha;
+    GLint palette[8] = { maxAlpha, minAlpha };
+    for (GLint i = 1; i < 7; i++) {
+      palette[i + 1] = ((7 - i) * maxAlpha + i * minAlpha) / 7;
+    }
+    uint64_t indices = 0;
+    for (GLint i = 0; i < 16 && maxAlpha != minAlpha; i++) {
+      GLint best = 0;
+      GLint bestError = 256;
+      for (GLint p = 0; p < 8; p++) {
+        const GLint error = glm::abs(palette[p] - block[i * 4 + 3]);
+        if (error < bestError) {
+          best = p;
+          bestError = error;
+        }
+      }
+      indices |= (uint64_t) best << (i * 3);
+    }
+    for (GLint i = 0; i < 6; i++) {
+      output[2 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+    output += 8;
+  }
+  GLint minColor[3] = { 255, 255, 255 };
+  GLint maxColor[3] = { 0, 0, 0 };
+  for (GLint i = 0; i < 16; i++) {
+    for (GLint c = 0; c < 3; c++) {
+      minColor[c] = glm::min(minColor[c], (GLint) block[i * 4 + c]);
+      maxColor[c] = glm::max(maxColor[c], (GLint) block[i * 4 + c]);
+    }
+  }
+  for (GLint c = 0; c < 3; c++) {
+    const GLint inset = (maxColor[c] - minColor[c]) >> 4;
+    minColor[c] += inset;
+    maxColor[c] -= inset;
+  }
+  const uint16_t endpoints[2] = {
+    (uint16_t) (((maxColor[0] >> 3) << 11) | ((maxColor[1] >> 2) << 5) | (maxColor[2] >> 3)),
+    (uint16_t) (((minColor[0] >> 3) << 11) | ((minColor[1] >> 2) << 5) | (minColor[2] >> 3))
+  };
+  GLint palette[4][3];
+  for (GLint e = 0; e < 2; e++) {
+    const GLint r = (endpoints[e] >> 11) & 31;
+    const GLint g = (endpoints[e] >> 5) & 63;
+    const GLint b = endpoints[e] & 31;
+    palette[e][0] = (r << 3) | (r >> 2);
+    palette[e][1] = (g << 2) | (g >> 4);
+    palette[e][2] = (b << 3) | (b >> 2);
+  }
+  for (GLint c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+  uint32_t indices = 0;
+  for (GLint i = 0; i < 16 && endpoints[0] != endpoints[1]; i++) {
+    GLint best = 0;
+    GLint bestError = 0x7FFFFFFF;
+    for (GLint p = 0; p < 4; p++) {
+      GLint error = 0;
+      for (GLint c = 0; c < 3; c++) {
+        const GLint d = palette[p][c] - block[i * 4 + c];
+        error += d * d;
+      }
+      if (error < bestError) {
+        best = p;
+        bestError = error;
+      }
+    }
+    indices |= (uint32_t) best << (i * 2);
+  }
+  std::memcpy(output, endpoints, sizeof(endpoints));
+  std::memcpy(output + 4, &indices, sizeof(indices));
+}
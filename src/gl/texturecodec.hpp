@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+struct TextureCodecLevel {
+  GLsizei width;
+  GLsizei height;
+  size_t offset;
+  size_t size;
+};
+
+// Pixels ready for glTextureStorage2D: either RGBA8 or compressed blocks
+struct TextureCodecData {
+  GLenum format;
+  bool isCompressed;
+  std::vector<TextureCodecLevel> levels;
+  std::vector<unsigned char> pixels;
+};
+
+// Reads KTX2 and DDS containers and compresses RGBA pixels into BC1/BC3.
+// Everything here is CPU only, so it can run on the workers.
+class TextureCodec {
+  public:
+    static bool load(const unsigned char* data, const size_t size, const bool srgb, TextureCodecData& texture);
+    static void compress(const unsigned char* rgba, const GLsizei width, const GLsizei height, const bool srgb, TextureCodecData& texture);
+    static bool read(const std::string& key, TextureCodecData& texture);
+    static void write(const std::string& key, const TextureCodecData& texture);
+  private:
+    static bool loadDDS(const unsigned char* data, const size_t size, const bool srgb, TextureCodecData& texture);
+    static bool loadKTX2(const unsigned char* data, const size_t size, TextureCodecData& texture);
+    static std::vector<unsigned char> downsample(const std::vector<unsigned char>& rgba, const GLsizei width, const GLsizei height, const bool srgb);
+    static void encodeBlock(const unsigned char* block, const bool withAlpha, unsigned char* output);
+};
@@ -116,31 +116,29 @@ void BRDF::update() {
   Shader shader(vertexShader, fragmentShader, false, true);
   PlaneGeometry plane(2, 2);
 
-  GLint framebuffer;
-  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
-  GLint viewport[4];
-  glGetIntegerv(GL_VIEWPORT, viewport);
-  GLint binding;
-  glGetIntegerv(GL_TEXTURE_BINDING_2D, &binding);
+  const GLuint framebuffer = GLState::getFramebuffer();
+  const GLint* current = GLState::getViewport();
+  const GLint viewport[4] = { current[0], current[1], current[2], current[3] };
+  const GLuint binding = GLState::getTexture(GL_TEXTURE_2D);
 
   glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
+  GLState::bindTexture(GL_TEXTURE_2D, texture);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glBindTexture(GL_TEXTURE_2D, binding);
+  GLState::bindTexture(GL_TEXTURE_2D, binding);
 
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
-  glViewport(0, 0, 512, 512);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+  GLState::setViewport(0, 0, 512, 512);
   shader.use();
   glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
   glClear(GL_COLOR_BUFFER_BIT);
   plane.draw();
 
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
-  glViewport(viewport[0], viewport[1], (GLsizei) viewport[2], (GLsizei) viewport[3]);
+  GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  GLState::setViewport(viewport[0], viewport[1], (GLsizei) viewport[2], (GLsizei) viewport[3]);
 
-  glDeleteFramebuffers(1, &fbo);
+  GLState::deleteFramebuffers(1, &fbo);
 }
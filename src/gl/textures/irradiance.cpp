@@ -31,11 +31,10 @@ GLuint Irradiance::get() {
 }
 
 void Irradiance::update() {
-  GLint binding;
-  glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &binding);
+  const GLuint binding = GLState::getTexture(GL_TEXTURE_CUBE_MAP);
 
   glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, texture);
   for (GLint i = 0; i < 6; i++) {
     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, Irradiance_data[i]);
   }
@@ -44,5 +43,5 @@ void Irradiance::update() {
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, binding);
+  GLState::bindTexture(GL_TEXTURE_CUBE_MAP, binding);
 }
@@ -34,8 +34,6 @@ static const GLushort faceIndices[2][6] = {
   { 2, 3, 0, 3, 1, 0 },
 };
 
-std::array<bool, VoxelChunk::size * VoxelChunk::size * VoxelChunk::size> VoxelChunk::collidersMap;
-
 VoxelChunk::VoxelChunk(Object* volume, const GLint x, const GLint y, const GLint z):
   Geometry(),
   body(nullptr),
@@ -144,79 +142,7 @@ void VoxelChunk::update() {
   version++;
 }
 
-void VoxelChunk::updateColliders() {
-  needsCollidersUpdate = false;
-  colliders.clear();
-  std::fill(collidersMap.begin(), collidersMap.end(), false);
-  for (GLint z = 0; z < size; z++) {
-    for (GLint y = 0; y < size; y++) {
-      for (GLint x = 0; x < size; x++) {
-        if (
-          get(x, y, z).type == VOXEL_TYPE_AIR
-          || collidersMap.at(z * size * size + y * size + x)
-        ) {
-          continue;
-        }
-
-        GLint width, height, depth;
-        for (GLint i = z + 1; i <= size; i++) {
-          if (
-            i == size
-            || get(x, y, i).type == VOXEL_TYPE_AIR
-            || collidersMap.at(i * size * size + y * size + x)
-          ) {
-            depth = i - z;
-            break;
-          }
-        }
-
-        height = size - y;
-        for (GLint i = z; i < z + depth; i++) {
-          for (GLint j = y + 1; j <= y + height; j++) {
-            if (
-              j == size
-              || get(x, j, i).type == VOXEL_TYPE_AIR
-              || collidersMap.at(i * size * size + j * size + x)
-            ) {
-              height = j - y;
-            }
-          }
-        }
-
-        width = size - x;
-        for (GLint i = z; i < z + depth; i++) {
-          for (GLint j = y; j < y + height; j++) {
-            for (GLint k = x + 1; k <= x + width; k++) {
-              if (
-                k == size
-                || get(k, j, i).type == VOXEL_TYPE_AIR
-                || collidersMap.at(i * size * size + j * size + k)
-              ) {
-                width = k - x;
-              }
-            }
-          }
-        }
-
-        for (GLint i = z; i < z + depth; i++) {
-          for (GLint j = y; j < y + height; j++) {
-            for (GLint k = x; k < x + width; k++) {
-              collidersMap.at(i * size * size + j * size + k) = true;
-            }
-          }
-        }
-
-        colliders.push_back({
-          GEOMETRY_COLLIDER_BOX,
-          glm::vec3(x, y, z) + glm::vec3(width, height, depth) * (GLfloat) 0.5,
-          glm::vec3(width, height, depth) * (GLfloat) 0.5
-        });
-      }
-    }
-  }
-}
-
-const Voxel& VoxelChunk::get(const GLint x, const GLint y, const GLint z) {
+const Voxel& VoxelChunk::get(const GLint x, const GLint y, const GLint z) const {
   GLint chunkX = 0;
   GLint voxelX = x + size / 2;
   if (voxelX >= size) {
@@ -24,6 +24,7 @@ class VoxelChunk : public Geometry {
     typedef std::array<Voxel, size * size * size> Data;
     std::array<Data*, 8> data;
     VoxelChunk(Object* volume, const GLint x, const GLint y, const GLint z);
+    const Voxel& get(const GLint x, const GLint y, const GLint z) const;
     btRigidBody* getBody();
     void setBody(btRigidBody* value);
     const GeometryBounds& getBounds();
@@ -32,7 +33,6 @@ class VoxelChunk : public Geometry {
     const glm::mat3& getNormalTransform();
     Object* getVolume();
     void update();
-    void updateColliders();
     bool needsCollidersUpdate;
   private:
     btRigidBody* body;
@@ -40,7 +40,5 @@ class VoxelChunk : public Geometry {
     glm::mat4 transform;
     glm::mat3 normalTransform;
     Object* volume;
-    const Voxel& get(const GLint x, const GLint y, const GLint z);
     static const GLfloat getAO(const bool n1, const bool n2, const bool n3);
-    static std::array<bool, size * size * size> collidersMap;
 };
@@ -0,0 +1,135 @@
+#include "collider.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Exposed faces per direction: +x, -x, +y, -y, +z, -z
+static const GLint colliderNormals[6][3] = {
+  { 1, 0, 0 },
+  { -1, 0, 0 },
+  { 0, 1, 0 },
+  { 0, -1, 0 },
+  { 0, 0, 1 },
+  { 0, 0, -1 },
+};
+
+VoxelCollider::VoxelCollider(VoxelChunk* chunk):
+  btConcaveShape(),
+  chunk(chunk),
+  scaling(1, 1, 1)
+{
+  m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE;
+}
+
+void VoxelCollider::getAabb(const btTransform& t, btVector3& aabbMin, btVector3& aabbMax) const {
+  const btScalar size = VoxelChunk::size;
+  btTransformAabb(btVector3(0, 0, 0), btVector3(size, size, size), getMargin(), t, aabbMin, aabbMax);
+}
+
+void VoxelCollider::processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const {
+  // Coplanar exposed faces are merged into rectangles, so there are
+  // no internal edges between cells for bodies to bump into.
+  const GLint size = VoxelChunk::size;
+  const GLint from[3] = {
+    std::max((GLint) floor(aabbMin.x()), 0),
+    std::max((GLint) floor(aabbMin.y()), 0),
+    std::max((GLint) floor(aabbMin.z()), 0),
+  };
+  const GLint to[3] = {
+    std::min((GLint) floor(aabbMax.x()), size - 1),
+    std::min((GLint) floor(aabbMax.y()), size - 1),
+    std::min((GLint) floor(aabbMax.z()), size - 1),
+  };
+  if (from[0] > to[0] || from[1] > to[1] || from[2] > to[2]) {
+    return;
+  }
+  bool mask[size * size];
+  btVector3 triangle[3];
+  for (GLint f = 0; f < 6; f++) {
+    const GLint* n = colliderNormals[f];
+    const GLint a = f / 2;
+    const GLint u = (a + 1) % 3;
+    const GLint v = (a + 2) % 3;
+    const GLint width = to[u] - from[u] + 1;
+    const GLint height = to[v] - from[v] + 1;
+    for (GLint d = from[a]; d <= to[a]; d++) {
+      GLint p[3];
+      p[a] = d;
+      for (GLint j = 0; j < height; j++) {
+        for (GLint i = 0; i < width; i++) {
+          p[u] = from[u] + i;
+          p[v] = from[v] + j;
+          mask[j * width + i] = (
+            chunk->get(p[0], p[1], p[2]).type != VOXEL_TYPE_AIR
+            && chunk->get(p[0] + n[0], p[1] + n[1], p[2] + n[2]).type == VOXEL_TYPE_AIR
+          );
+        }
+      }
+      for (GLint j = 0; j < height; j++) {
+        for (GLint i = 0; i < width;) {
+          if (!mask[j * width + i]) {
+            i++;
+            continue;
+          }
+          GLint w = 1;
+          while (i + w < width && mask[j * width + i + w]) {
+            w++;
+          }
+          GLint h = 1;
+          for (; j + h < height; h++) {
+            const bool* row = mask + (j + h) * width + i;
+            if (!std::all_of(row, row + w, [](bool exposed) { return exposed; })) {
+              break;
+            }
+          }
+          for (GLint y = 0; y < h; y++) {
+            bool* row = mask + (j + y) * width + i;
+            std::fill(row, row + w, false);
+          }
+          // (u, v, a) is a right-handed cycle, so the winding flips for the negative faces
+          const btScalar plane = d + (n[a] > 0 ? 1 : 0);
+          const btScalar u0 = from[u] + i, u1 = u0 + w;
+          const btScalar v0 = from[v] + j, v1 = v0 + h;
+          const btScalar corners[4][2] = {
+            { u0, v0 },
+            { n[a] > 0 ? u1 : u0, n[a] > 0 ? v0 : v1 },
+            { u1, v1 },
+            { n[a] > 0 ? u0 : u1, n[a] > 0 ? v1 : v0 },
+          };
+          btVector3 quad[4];
+          for (GLint c = 0; c < 4; c++) {
+            quad[c][a] = plane;
+            quad[c][u] = corners[c][0];
+            quad[c][v] = corners[c][1];
+          }
+          const GLint cell = p[a] * size * size + (from[v] + j) * size + from[u] + i;
+          triangle[0] = quad[0];
+          triangle[1] = quad[1];
+          triangle[2] = quad[2];
+          callback->processTriangle(triangle, 0, (cell * 6 + f) * 2);
+          triangle[0] = quad[0];
+          triangle[1] = quad[2];
+          triangle[2] = quad[3];
+          callback->processTriangle(triangle, 0, (cell * 6 + f) * 2 + 1);
+          i += w;
+        }
+      }
+    }
+  }
+}
+
+void VoxelCollider::calculateLocalInertia(btScalar mass, btVector3& inertia) const {
+  // Chunks are always static
+  inertia.setValue(0, 0, 0);
+}
+
+void VoxelCollider::setLocalScaling(const btVector3& scaling) {
+  this->scaling = scaling;
+}
+
+const btVector3& VoxelCollider::getLocalScaling() const {
+  return scaling;
+}
+
+const char* VoxelCollider::getName() const {
+  return "VoxelCollider";
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "chunk.hpp"
+#include <btBulletDynamicsCommon.h>
+
+// Concave shape that reads the chunk voxels directly.
+// Only the exposed faces of the cells overlapping a query are turned
+// into triangles, so edits never need to rebuild the shape.
+class VoxelCollider : public btConcaveShape {
+  public:
+    VoxelCollider(VoxelChunk* chunk);
+    virtual void getAabb(const btTransform& t, btVector3& aabbMin, btVector3& aabbMax) const;
+    virtual void processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const;
+    virtual void calculateLocalInertia(btScalar mass, btVector3& inertia) const;
+    virtual void setLocalScaling(const btVector3& scaling);
+    virtual const btVector3& getLocalScaling() const;
+    virtual const char* getName() const;
+  private:
+    VoxelChunk* chunk;
+    btVector3 scaling;
+};
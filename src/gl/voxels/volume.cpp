@@ -15,9 +15,8 @@ Voxels::~Voxels() {
     delete v;
   }
   for (const auto& [k, v] : chunks) {
-    btRigidBody* body = v->getBody();
-    if (body != nullptr) {
-      physics->removeBody(body);
+    if (isPhysicsEnabled) {
+      physics->removeBody(v);
     }
     delete v;
   }
@@ -27,13 +26,9 @@ void Voxels::enablePhysics() {
   if (isPhysicsEnabled) {
     return;
   }
+  isPhysicsEnabled = true;
   for (const auto& [k, chunk] : chunks) {
-    if (chunk->getBody() == nullptr) {
-      if (chunk->needsCollidersUpdate) {
-        chunk->updateColliders();
-      }
-      physics->addBody(chunk);
-    }
+    physics->addBody(chunk);
   }
 }
 
@@ -41,11 +36,9 @@ void Voxels::disablePhysics() {
   if (!isPhysicsEnabled) {
     return;
   }
+  isPhysicsEnabled = false;
   for (const auto& [k, chunk] : chunks) {
-    btRigidBody* body = chunk->getBody();
-    if (body != nullptr) {
-      physics->removeBody(body);
-    }
+    physics->removeBody(chunk);
   }
 }
 
@@ -84,19 +77,40 @@ VoxelChunk* Voxels::getChunk(const GLint x, const GLint y, const GLint z) {
   return chunks[key];
 }
 
-void Voxels::render(Camera* camera) {
+void Voxels::render(Camera* camera, Drawbuffer* drawbuffer) {
   shader->setCameraUniforms(camera);
-  shader->use();
+  if (!shader->use()) {
+    return;
+  }
   for (const auto& [key, chunk] : chunks) {
     if (!camera->isInFrustum(chunk->getBounds())) {
       continue;
     }
-    shader->setUniformMat4("modelMatrix", chunk->getTransform());
-    shader->setUniformMat3("normalMatrix", chunk->getNormalTransform());
+    shader->setModelUniforms(drawbuffer, chunk->getTransform(), chunk->getNormalTransform());
     chunk->draw();
   }
 }
 
+void Voxels::enqueue(Camera* camera, RenderQueue* queue) {
+  for (const auto& [key, chunk] : chunks) {
+    if (!camera->isInFrustum(chunk->getBounds())) {
+      continue;
+    }
+    queue->push({
+      chunk,
+      shader,
+      nullptr,
+      0,
+      chunk->getTransform(),
+      chunk->getNormalTransform(),
+      glm::distance(camera->getPosition(), chunk->getBounds().position),
+      {},
+      0,
+      {}
+    });
+  }
+}
+
 void Voxels::set(const GLint x, const GLint y, const GLint z, const VoxelType type, const GLubyte r, const GLubyte g, const GLubyte b) {
   GLint cx = floor((GLfloat) x / VoxelChunk::size);
   GLint cy = floor((GLfloat) y / VoxelChunk::size);
@@ -127,7 +141,10 @@ void Voxels::set(const GLint x, const GLint y, const GLint z, const VoxelType ty
           if (needsUpdate) {
             chunk->needsUpdate = true;
           }
-          chunk->needsCollidersUpdate = true;
+          if (!chunk->needsCollidersUpdate) {
+            chunk->needsCollidersUpdate = true;
+            physics->queueCollidersUpdate(chunk);
+          }
         }
       }
     }
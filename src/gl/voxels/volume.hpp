@@ -17,7 +17,8 @@ class Voxels: public Object {
     void disablePhysics();
     const std::map<std::string, VoxelChunk*>& getChunks();
     Shader* getShader();
-    void render(Camera* camera);
+    void render(Camera* camera, Drawbuffer* drawbuffer);
+    void enqueue(Camera* camera, RenderQueue* queue);
     Voxel get(const GLint x, const GLint y, const GLint z);
     void set(const GLint x, const GLint y, const GLint z, const VoxelType type, const GLubyte r, const GLubyte g, const GLubyte b);
     bool ground(const GLint x, const GLint y, const GLint z, const GLint height, GLint& ground);
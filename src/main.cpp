@@ -1,9 +1,15 @@
+#include "core/benchmark.hpp"
 #include "core/http.hpp"
 #include "core/script.hpp"
 #include "core/vm.hpp"
 #include "core/window.hpp"
 
 int main(int argc, char* argv[]) {
+  if (argc == 2 && std::string(argv[1]) == "--benchmark-physics") {
+    PhysicsBenchmark::run();
+    return EXIT_SUCCESS;
+  }
+
   WindowContext ctx;
   ImGuiIO& io = ImGui::GetIO();
   GLfloat lastTick = 0.0;